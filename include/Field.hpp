@@ -2,12 +2,14 @@
 #define FIELD_HPP_
 
 #pragma warning (disable : 4146)
-#include <NTL/ZZ_pEX.h>
+#include <NTL/ZZ.h>
 
 #include <variant>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <limits>
+#include <vector>
 
 #include <boost/variant.hpp>
 
@@ -16,23 +18,27 @@ namespace gadgetlib
 	template<typename T>
 	class Field
 	{
-	public:
-		NTL::ZZ_p num_;
-		NTL::ZZ unreduced_num_;
-		static bool initialized_;
-		static NTL::ZZ chp;
-
 	private:
-		void initialize()
+		//values whose absolute value is below SMALL_LIMIT (bits, +-1, small powers of two...)
+		//are kept in small_ and never reach NTL; num_ holds the residue otherwise
+		static constexpr int SMALL_BITS = std::numeric_limits<long>::digits - 1;
+		static constexpr long SMALL_LIMIT = 1L << SMALL_BITS;
+
+		bool is_small_ = true;
+		long small_ = 0;
+		NTL::ZZ num_;
+
+	public:
+		//the modulus is a property of the type: it is built once on first use (thread-safe
+		//since C++11) and only read afterwards, so fields over different characteristics
+		//can be used side by side and from any thread
+		static const NTL::ZZ& chp()
 		{
-			if (!initialized_)
-			{
-				initialized_ = true;
-				chp = NTL::conv<NTL::ZZ>(T::characteristics);
-				NTL::ZZ_p::init(chp);
-			}
+			static const NTL::ZZ modulus = NTL::conv<NTL::ZZ>(T::characteristics);
+			return modulus;
 		}
 
+	private:
 		NTL::ZZ hexToZZ(const std::string& hexVal)
 		{
 			bool decimal = (hexVal[0] == 'd');
@@ -68,80 +74,207 @@ namespace gadgetlib
 
 				}
 			}
-			unreduced_num_ = val;
 			return val;
 		}
 		
-	public:
-		static constexpr uint64_t safe_bitsize = T::safe_bitsize;
+		static bool fits_small(long val)
+		{
+			return (val > -SMALL_LIMIT) && (val < SMALL_LIMIT);
+		}
 
-		Field(size_t num)
+		static bool mul_fits_small(long a, long b)
+		{
+			long abs_a = (a < 0 ? -a : a);
+			long abs_b = (b < 0 ? -b : b);
+			return (abs_a == 0) || (abs_b < SMALL_LIMIT / abs_a);
+		}
+
+		NTL::ZZ residue() const
+		{
+			if (!is_small_)
+				return num_;
+			NTL::ZZ result = NTL::conv<NTL::ZZ>(small_);
+			if (small_ < 0)
+				result += chp();
+			return result;
+		}
+
+		void promote()
+		{
+			if (is_small_)
+			{
+				num_ = residue();
+				is_small_ = false;
+			}
+		}
+
+		void demote()
 		{
-			initialize();
-			NTL::ZZ temp = NTL::conv<NTL::ZZ>(num);
-			num_ = NTL::conv<NTL::ZZ_p>(temp);
+			if (NTL::NumBits(num_) <= SMALL_BITS)
+			{
+				small_ = NTL::conv<long>(num_);
+				is_small_ = true;
+			}
 		}
 
-		Field()
+		void set_residue(const NTL::ZZ& residue)
 		{
-			initialize();
+			num_ = residue;
+			is_small_ = false;
+			demote();
 		}
 
-		Field(const NTL::ZZ_p& num)
+		//num_ = num_ + val mod chp(), where |val| < chp()
+		void add_small_to_residue(long val)
 		{
-			initialize();
-			num_ = num;
+			NTL::add(num_, num_, val);
+			if (num_ >= chp())
+				num_ -= chp();
+			else if (NTL::sign(num_) < 0)
+				num_ += chp();
 		}
 
+	public:
+		static constexpr uint64_t safe_bitsize = T::safe_bitsize;
+
+		/**
+		* Accumulates products of representatives without reducing them, so that a sum of
+		* products costs a single reduction modulo the characteristics.
+		*/
+		class accumulator
+		{
+		private:
+			NTL::ZZ sum_;
+			long small_sum_ = 0;
+		public:
+			void mul_add(const Field& a, const Field& b)
+			{
+				if (a.is_small_ && b.is_small_)
+				{
+					if (mul_fits_small(a.small_, b.small_))
+					{
+						long prod = a.small_ * b.small_;
+						if (!fits_small(small_sum_ + prod))
+						{
+							NTL::add(sum_, sum_, small_sum_);
+							small_sum_ = 0;
+						}
+						small_sum_ += prod;
+					}
+					else
+						NTL::MulAddTo(sum_, NTL::conv<NTL::ZZ>(a.small_), b.small_);
+				}
+				else if (a.is_small_)
+					NTL::MulAddTo(sum_, b.num_, a.small_);
+				else if (b.is_small_)
+					NTL::MulAddTo(sum_, a.num_, b.small_);
+				else
+					NTL::MulAddTo(sum_, a.num_, b.num_);
+			}
+
+			Field reduce() const
+			{
+				NTL::ZZ total;
+				NTL::add(total, sum_, small_sum_);
+				Field result;
+				NTL::rem(total, total, chp());
+				result.set_residue(total);
+				return result;
+			}
+		};
+
+		Field(size_t num)
+		{
+			if (num < (size_t)SMALL_LIMIT)
+				small_ = (long)num;
+			else
+				set_residue(NTL::conv<NTL::ZZ>(num) % chp());
+		}
+
+		Field() = default;
+
 		Field(const boost::variant<uint32_t, std::string>& v)
 		{
-			initialize();
-			//uint32_t n;
 			switch (v.which())
 			{
 			case 0:
 			{
-				NTL::ZZ num = NTL::conv<NTL::ZZ>(boost::get<uint32_t>(v));
-				num_ = NTL::conv<NTL::ZZ_p>(num);
+				small_ = (long)boost::get<uint32_t>(v);
+				if (!fits_small(small_))
+					set_residue(NTL::conv<NTL::ZZ>(small_));
 				break;
 			}
 			case 1:
 				NTL::ZZ int_num = hexToZZ(boost::get<std::string>(v));
-				num_ = NTL::conv<NTL::ZZ_p>(int_num);
+				set_residue(int_num % chp());
 				break;
 			};
 		}
 
 		Field(bool flag, bool q)
 		{
-			initialize();
-			NTL::ZZ num = NTL::conv<NTL::ZZ>(flag ? 1 : 0);
-			num_ = NTL::conv<NTL::ZZ_p>(num);
+			small_ = (flag ? 1 : 0);
 		}
 
 		Field& operator+=(const Field& rhs)
 		{
-			this->num_ += rhs.num_;
+			if (is_small_ && rhs.is_small_ && fits_small(small_ + rhs.small_))
+			{
+				small_ += rhs.small_;
+				return *this;
+			}
+			promote();
+			if (rhs.is_small_)
+				add_small_to_residue(rhs.small_);
+			else
+				NTL::AddMod(num_, num_, rhs.num_, chp());
+			demote();
 			return *this;
 		}
 
-
 		Field& operator-=(const Field& rhs)
 		{
-			this->num_ -= rhs.num_;
+			if (is_small_ && rhs.is_small_ && fits_small(small_ - rhs.small_))
+			{
+				small_ -= rhs.small_;
+				return *this;
+			}
+			promote();
+			if (rhs.is_small_)
+				add_small_to_residue(-rhs.small_);
+			else
+				NTL::SubMod(num_, num_, rhs.num_, chp());
+			demote();
 			return *this;
 		}
 
 		Field& operator*=(const Field& rhs)
 		{
-			this->num_ *= rhs.num_;
+			if (is_small_ && rhs.is_small_ && mul_fits_small(small_, rhs.small_))
+			{
+				small_ *= rhs.small_;
+				return *this;
+			}
+			promote();
+			if (rhs.is_small_)
+			{
+				NTL::mul(num_, num_, rhs.small_);
+				NTL::rem(num_, num_, chp());
+			}
+			else
+				NTL::MulMod(num_, num_, rhs.num_, chp());
+			demote();
 			return *this;
 		}
 
-		Field& operator-()
+		Field operator-() const
 		{
-			this->num_ = -this->num_;
-			return *this;
+			Field result;
+			if (is_small_)
+				result.small_ = -small_;
+			else
+				result.set_residue(NTL::IsZero(num_) ? num_ : chp() - num_);
+			return result;
 		}
 
 		static Field one()
@@ -156,30 +289,103 @@ namespace gadgetlib
 
 		operator bool() const
 		{
-			return num_ != 0;
+			return (is_small_ ? small_ != 0 : !NTL::IsZero(num_));
+		}
+
+		bool equals(const Field& other) const
+		{
+			//small values are canonical and big values are always reduced residues
+			if (is_small_ && other.is_small_)
+				return small_ == other.small_;
+			if (!is_small_ && !other.is_small_)
+				return num_ == other.num_;
+			return residue() == other.residue();
+		}
+
+		//hash consistent with equals: the low 64 bits of the residue, computed without touching
+		//NTL for small values
+		uint64_t hash() const
+		{
+			static const uint64_t modulus_low = (uint64_t)NTL::trunc_long(chp(), 64);
+			if (is_small_)
+				return (small_ >= 0 ? (uint64_t)small_ : modulus_low + (uint64_t)small_);
+			return (uint64_t)NTL::trunc_long(num_, 64);
 		}
 
 		std::string to_string() const
 		{
 			std::stringstream buffer;
-			buffer << num_;
+			buffer << residue();
 			return buffer.str();
 		}
 
+		//number of bytes in the canonical encoding, i.e. the byte length of the modulus
+		static size_t byte_size()
+		{
+			return (size_t)NTL::NumBytes(chp());
+		}
+
+		//little-endian canonical representative, padded to byte_size()
+		std::vector<uint8_t> to_bytes() const
+		{
+			std::vector<uint8_t> result(byte_size());
+			NTL::BytesFromZZ(result.data(), residue(), (long)result.size());
+			return result;
+		}
+
+		//little-endian number of any length, reduced modulo the characteristics
+		static Field from_bytes(const uint8_t* data, size_t size)
+		{
+			while (size > 0 && data[size - 1] == 0)
+				size--;
+			Field result;
+			if (size < sizeof(long))
+			{
+				long val = 0;
+				for (size_t i = size; i > 0; i--)
+					val = (val << 8) | data[i - 1];
+				if (fits_small(val))
+				{
+					result.small_ = val;
+					return result;
+				}
+			}
+			NTL::ZZ num;
+			NTL::ZZFromBytes(num, data, (long)size);
+			result.set_residue(num % chp());
+			return result;
+		}
+
 		Field inverse() const
 		{
-			NTL::ZZ_p inverse = NTL::conv<NTL::ZZ_p>(NTL::InvMod(NTL::rep(num_), chp));
-			return Field(inverse);
+			if (is_small_ && (small_ == 1 || small_ == -1))
+				return *this;
+			NTL::ZZ inverse;
+			NTL::InvMod(inverse, residue(), chp());
+			Field result;
+			result.set_residue(inverse);
+			return result;
 		}
 
 		Field get_bit_at_pos(unsigned index)
 		{
-			return (NTL::bit(NTL::conv<NTL::ZZ>(num_), index) ? Field::one() : Field::zero());
+			if (is_small_ && small_ >= 0)
+				return ((index < SMALL_BITS) && ((small_ >> index) & 1)) ? Field::one() : Field::zero();
+			return (NTL::bit(residue(), index) ? Field::one() : Field::zero());
 		}
 
-		Field get_bit_at_pos_unreduced(unsigned index)
+		//writes bits first_bit, ..., first_bit + count - 1 of the residue to bits[0..count)
+		void get_bits(Field* bits, size_t count, size_t first_bit = 0) const
 		{
-			return (NTL::bit(unreduced_num_, index) ? Field::one() : Field::zero());
+			if (is_small_ && small_ >= 0)
+			{
+				for (size_t i = 0, pos = first_bit; i < count; i++, pos++)
+					bits[i] = Field((pos < SMALL_BITS) && ((small_ >> pos) & 1), true);
+				return;
+			}
+			NTL::ZZ num = residue();
+			for (size_t i = 0; i < count; i++)
+				bits[i] = Field(NTL::bit(num, (long)(first_bit + i)) != 0, true);
 		}
 	};
 
@@ -187,49 +393,49 @@ namespace gadgetlib
 	Field<T> operator+(const Field<T>& left,
 		const Field<T>& right)
 	{
-		return Field<T>(left.num_ + right.num_);
+		Field<T> result = left;
+		result += right;
+		return result;
 	}
 
 	template<typename T>
 	Field<T> operator-(const Field<T>& left,
 		const Field<T>& right)
 	{
-		return Field<T>(left.num_ - right.num_);
+		Field<T> result = left;
+		result -= right;
+		return result;
 	}
 
 	template<typename T>
 	Field<T> operator*(const Field<T>& left,
 		const Field<T>& right)
 	{
-		return Field<T>(left.num_ * right.num_);
+		Field<T> result = left;
+		result *= right;
+		return result;
 	}
 
 	template<typename T>
 	bool operator==(const Field<T>& left,
 		const Field<T>& right)
 	{
-		return (left.num_ == right.num_);
+		return left.equals(right);
 	}
 
 	template<typename T>
 	bool operator!=(const Field<T>& left,
 		const Field<T>& right)
 	{
-		return (left.num_ != right.num_);
+		return !left.equals(right);
 	}
 
 	template<typename T>
 	std::ostream& operator<< (std::ostream& stream, const Field<T>& elem)
 	{
-		stream << elem.num_;
+		stream << elem.to_string();
 		return stream;
 	}
-
-	template<typename T>
-	bool Field<T>::initialized_ = false;
-
-	template<typename T>
-	NTL::ZZ Field<T>::chp;
 }
 
 #endif
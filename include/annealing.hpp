@@ -4,9 +4,11 @@
 #include "gadget.hpp"
 #include "protoboard.hpp"
 
-#include <map>
+#include <vector>
 #include <stack>
 #include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
 
 namespace gadgetlib
 {	
@@ -18,126 +20,216 @@ namespace gadgetlib
 		struct node_metadata
 		{
 			var_index_t packed_index = 0;
-			var_index_t low_unpacked_index = 0;
-			var_index_t upper_unpacked_index = 0;
+			//wires of the bits, least significant first; wiring-only operations (INDEX, SHR,
+			//rotations, CONCATENATION) only permute the lists of their arguments, so their bits
+			//need not be consecutive and may refer to the shared zero wire
+			variable_list bits;
 			uint32_t overflowed = 0;
-			node_metadata() : packed_index(0), low_unpacked_index(0), 
-				upper_unpacked_index(0) {}
+			//summands (packed wire, its overflow) of a fixed-width addition that has no wire
+			//yet: nested additions are merged into it, and the whole sum gets a single row
+			//when its value is first needed
+			std::vector<std::pair<var_index_t, uint32_t>> pending_sum;
+			node_metadata() : packed_index(0) {}
 		};
 
-		using metadata_storage = std::map<const abstract_node*, node_metadata>;
+		static uint32_t ceil_log2(size_t val)
+		{
+			uint32_t result = 0;
+			while (((size_t)1 << result) < val)
+				result++;
+			return result;
+		}
+
+		static variable_list to_list(std::pair<var_index_t, var_index_t> index_range)
+		{
+			variable_list result(index_range.second - index_range.first + 1);
+			for (size_t i = 0; i < result.size(); i++)
+				result[i] = index_range.first + i;
+			return result;
+		}
+
+		//per-node data of one incorporate_gadget call. The nodes reachable from the gadget are
+		//numbered densely, so the tables are sized by the gadget rather than by the whole arena
+		//it was built in; the data is allocated once all nodes are numbered, so references to
+		//entries stay valid
+		class metadata_storage
+		{
+		private:
+			std::unordered_map<node_handle, uint32_t> indexes_;
+			std::vector<node_metadata> data_;
+		public:
+			//numbers node if it is new; returns its number and whether it was new
+			std::pair<uint32_t, bool> add(const abstract_node* node)
+			{
+				auto res = indexes_.emplace(node->id_, (uint32_t)indexes_.size());
+				return { res.first->second, res.second };
+			}
+			void allocate() { data_.resize(indexes_.size()); }
+			uint32_t size() const { return (uint32_t)indexes_.size(); }
+
+			uint32_t index(const abstract_node* node) const
+			{
+				auto it = indexes_.find(node->id_);
+				assert(it != indexes_.end());
+				return it->second;
+			}
+			node_metadata& operator[](const abstract_node* node) { return data_[index(node)]; }
+		};
+
+		//gives a pending sum its wire: one row for all summands, and the overflow grows by
+		//ceil(log2(n)) instead of by one per addition
+		template<typename FieldT>
+		void materialize_sum(protoboard<FieldT>& pboard, node_metadata& metadata)
+		{
+			if (metadata.pending_sum.empty())
+				return;
+			var_index_t result_index = pboard.get_free_var();
+			pb_linear_combination<FieldT> sum;
+			FieldT value = 0;
+			uint32_t max_overflow = 0;
+			for (const auto& term : metadata.pending_sum)
+			{
+				sum += pb_linear_term<FieldT>(term.first, 1);
+				value += pboard.assignment[term.first];
+				max_overflow = std::max(max_overflow, term.second);
+			}
+			pboard.add_r1cs_constraint(1, pboard.idx2var(result_index), std::move(sum));
+			pboard.assignment[result_index] = value;
+			metadata.packed_index = result_index;
+			metadata.overflowed = max_overflow + ceil_log2(metadata.pending_sum.size());
+			metadata.pending_sum.clear();
+		}
+
+		//appends the summands of child to sum: those of a pending sum (taken over if this is
+		//its only use), otherwise the packed wire of child itself
+		template<typename FieldT>
+		void add_summand(protoboard<FieldT>& pboard, metadata_storage& storage,
+			const std::vector<uint32_t>& num_uses, abstract_node* child,
+			std::vector<std::pair<var_index_t, uint32_t>>& sum)
+		{
+			node_metadata& metadata = storage[child];
+			if (!metadata.pending_sum.empty())
+			{
+				sum.insert(sum.end(), metadata.pending_sum.begin(), metadata.pending_sum.end());
+				if (num_uses[storage.index(child)] == 1)
+					metadata.pending_sum = {};
+				return;
+			}
+			var_index_t index = get_packed_var(pboard, storage, child);
+			sum.emplace_back(index, storage[child].overflowed);
+		}
 
 		template<typename FieldT>
 		var_index_t get_packed_var(protoboard<FieldT>& pboard, metadata_storage& storage,
 			abstract_node* node, bool overflow_reduction = false)
 		{
 			node_metadata& metadata = storage[node];
+			materialize_sum(pboard, metadata);
 			if ((overflow_reduction) && (metadata.packed_index != 0))
 			{
 				auto index_range = pboard.unpack_bits(metadata.packed_index, 
 					node->bitsize_ + metadata.overflowed);
 				pboard.compute_unpacked_assignment(metadata.packed_index, index_range);
 
-				metadata.low_unpacked_index = index_range.first;
-				metadata.upper_unpacked_index = index_range.first + node->bitsize_ - 1;
+				metadata.bits = to_list(index_range);
+				metadata.bits.resize(node->bitsize_);
 
-				metadata.packed_index = pboard.pack_bits(index_range.first,
-					index_range.first + node->bitsize_ - 1);
+				metadata.packed_index = pboard.pack_bits(metadata.bits);
 				pboard.assignment[metadata.packed_index] =
-					pboard.compute_packed_assignment(index_range.first,
-						index_range.first + node->bitsize_ - 1);
+					pboard.compute_packed_assignment(metadata.bits);
 			}
-			else if ((metadata.packed_index == 0) && (metadata.low_unpacked_index == 0))
+			else if ((metadata.packed_index == 0) && metadata.bits.empty())
 			{						
 				metadata.packed_index = pboard.get_free_var();
-				if (auto* ie = dynamic_cast<input_node*>(node))
+				switch (node->node_kind_)
+				{
+				case (NODE_KIND::INPUT_GADGET):
 				{
+					auto* ie = static_cast<input_node*>(node);
 					if (ie->is_public_input_)
 						pboard.add_public_wire(metadata.packed_index);
 					
-					pboard.assignment[metadata.packed_index] = FieldT(ie->witness_);
+					pboard.assignment[metadata.packed_index] =
+						ie->witness_.template to_field<FieldT>();
+					break;
 				}
-				else if (auto* ce = dynamic_cast<const_node*>(node))
+				case (NODE_KIND::CONSTANT_GADGET):
 				{
-					pboard.add_r1cs_constraint(1,
-						pboard.idx2var(metadata.packed_index), FieldT(ce->value_));
+					auto* ce = static_cast<const_node*>(node);
+					FieldT value = ce->value_.template to_field<FieldT>();
+					pboard.add_r1cs_constraint(1, pboard.idx2var(metadata.packed_index), value);
 						
-					pboard.assignment[metadata.packed_index] = FieldT(ce->value_);
+					pboard.assignment[metadata.packed_index] = value;
+					break;
+				}
+				default:
+					assert(false && "No node for this type");
+					break;
 				}
-				else
-					assert(false && "No node for this type");					
 			}
-			else if (metadata.low_unpacked_index != 0)
+			else if (!metadata.bits.empty())
 			{
-				metadata.packed_index = pboard.pack_bits(metadata.low_unpacked_index,
-					metadata.upper_unpacked_index);
+				metadata.packed_index = pboard.pack_bits(metadata.bits);
 
 				pboard.assignment[metadata.packed_index] =
-					pboard.compute_packed_assignment(metadata.low_unpacked_index,
-						metadata.upper_unpacked_index);
+					pboard.compute_packed_assignment(metadata.bits);
 			}
 			return metadata.packed_index;
 		}
 
 		template<typename FieldT>
-		std::pair<var_index_t, var_index_t> get_unpacked_var(protoboard<FieldT>& pboard, 
+		const variable_list& get_unpacked_var(protoboard<FieldT>& pboard, 
 			metadata_storage& storage, abstract_node* node)
 		{
 			node_metadata& metadata = storage[node];
-			if ((metadata.packed_index == 0) && (metadata.low_unpacked_index == 0))
+			materialize_sum(pboard, metadata);
+			if ((metadata.packed_index == 0) && metadata.bits.empty())
 			{
-				auto index_range = pboard.get_free_var_range(node->bitsize_);
-				metadata.low_unpacked_index = index_range.first;
-				metadata.upper_unpacked_index = index_range.second;
-				if (auto* ie = dynamic_cast<input_node*>(node))
+				switch (node->node_kind_)
+				{
+				case (NODE_KIND::INPUT_GADGET):
 				{
+					auto index_range = pboard.get_free_var_range(node->bitsize_);
+					metadata.bits = to_list(index_range);
+					auto* ie = static_cast<input_node*>(node);
 					if (ie->is_public_input_)
 						pboard.add_public_wire_range(index_range.first, index_range.second);
 					for (auto idx = index_range.first; idx <= index_range.second; idx++)
 						pboard.make_boolean(idx);
 
-					auto val = FieldT(ie->witness_);
+					//bits are taken from the value as given, even if it exceeds the modulus
 					auto idx = index_range.first;
 					unsigned index_pos = 0;
-					if (node->bitsize_ < FieldT::safe_bitsize)
-					{
-						while (idx <= index_range.second)
-						{
-							pboard.assignment[idx++] = val.get_bit_at_pos(index_pos++);
-						}
-					}
-					else
+					while (idx <= index_range.second)
 					{
-						while (idx <= index_range.second)
-						{
-							pboard.assignment[idx++] = val.get_bit_at_pos_unreduced(index_pos++);
-						}
+						pboard.assignment[idx++] = FieldT(ie->witness_.get_bit(index_pos++), true);
 					}
+					break;
 				}
-				else if (auto* ce = dynamic_cast<const_node*>(node))
+				case (NODE_KIND::CONSTANT_GADGET):
 				{
-					FieldT value = FieldT(ce->value_);
-					var_index_t idx = index_range.first;
-					unsigned index_pos = 0;
+					//constant bits need no wires of their own: they are the constant one
+					//and the shared zero wire
+					auto* ce = static_cast<const_node*>(node);
+					metadata.bits.resize(node->bitsize_);
 					for (unsigned i = 0; i < node->bitsize_; i++)
-					{
-						FieldT bit = value.get_bit_at_pos(index_pos++);
-						pboard.add_r1cs_constraint(1, pboard.idx2var(idx), bit);
-						pboard.assignment[idx++] = bit;
-					}
+						metadata.bits[i] = (ce->value_.get_bit(i) ? 0 : pboard.zero_var());
+					break;
 				}
-				else
+				default:
 					assert(false && "No node for this type");
+					break;
+				}
 			}
-			else if (metadata.packed_index != 0)
+			else if (metadata.bits.empty())
 			{
 				auto index_range = pboard.unpack_bits(metadata.packed_index, 
 					node->bitsize_ + metadata.overflowed);
-				metadata.low_unpacked_index = index_range.first;
-				metadata.upper_unpacked_index = index_range.first + node->bitsize_ - 1;
+				metadata.bits = to_list(index_range);
+				metadata.bits.resize(node->bitsize_);
 				pboard.compute_unpacked_assignment(metadata.packed_index, index_range);
 			}
-			return std::make_pair(metadata.low_unpacked_index, metadata.upper_unpacked_index);
+			return metadata.bits;
 		}
 
 		template<typename FieldT>
@@ -175,7 +267,37 @@ namespace gadgetlib
 			}
 		}
 
+		//Montgomery's trick: all queued values are inverted with a single field inversion
+		//(three multiplications per element). Zero has no inverse and is assigned zero.
+		template<typename FieldT>
+		void fill_inverses(protoboard<FieldT>& pboard,
+			const std::vector<std::pair<var_index_t, FieldT>>& pending)
+		{
+			std::vector<FieldT> prefix_products;
+			prefix_products.reserve(pending.size());
+			FieldT acc = FieldT::one();
+			for (auto& elem : pending)
+			{
+				if (elem.second)
+					acc *= elem.second;
+				prefix_products.emplace_back(acc);
+			}
+			FieldT inv = acc.inverse();
+			for (size_t i = pending.size(); i > 0; i--)
+			{
+				auto& elem = pending[i - 1];
+				if (!elem.second)
+				{
+					pboard.assignment[elem.first] = FieldT::zero();
+					continue;
+				}
+				pboard.assignment[elem.first] = (i > 1 ? inv * prefix_products[i - 2] : inv);
+				inv *= elem.second;
+			}
+		}
+
 	public:
+		//g has to be alive: its arena may be any one, but not cleared or freed since g was built
 		template<typename FieldT>
 		void incorporate_gadget(protoboard<FieldT>& pboard, const gadget& g)
 		{					
@@ -186,31 +308,59 @@ namespace gadgetlib
 				vertex(const op_node* g_ptr) : g_ptr_(g_ptr), childs_processed_(0) {};
 			};
 
+			if (!node_arena::is_live(g.arena_generation_))
+				throw std::runtime_error("engraver: the gadget's node arena was cleared or freed");
+			assert(g.kind_ == NODE_KIND::OPERATION_GADGET);
+
 			std::stack<vertex> vertexes;
-			std::set<const op_node*> processed_nodes;
 			metadata_storage storage;
-			assert(g.kind_ == NODE_KIND::OPERATION_GADGET);
-			vertexes.push(dynamic_cast<const op_node*>(g.node_.get()));
+			//inverse witnesses are filled in one batch after the whole gadget is lowered
+			std::vector<std::pair<var_index_t, FieldT>> pending_inverses;
+
+			//number of parents of every operation, so additions used only once can hand
+			//their summands over to the enclosing one; the reachable nodes get numbered on
+			//the way
+			storage.add(g.node_);
+			std::vector<uint32_t> num_uses = { 0 };
+			std::vector<const op_node*> to_visit = { static_cast<const op_node*>(g.node_) };
+			while (!to_visit.empty())
+			{
+				const op_node* node = to_visit.back();
+				to_visit.pop_back();
+				for (unsigned i = 0; i < node->get_num_of_children(); i++)
+				{
+					auto* child = node->get_child(i);
+					auto added = storage.add(child);
+					if (added.second)
+						num_uses.push_back(0);
+					if (num_uses[added.first]++ == 0 && child->node_kind_ == NODE_KIND::OPERATION_GADGET)
+						to_visit.push_back(static_cast<const op_node*>(child));
+				}
+			}
+			storage.allocate();
+			std::vector<bool> processed_nodes(storage.size(), false);
+
+			vertexes.push(static_cast<const op_node*>(g.node_));
 
 			while (vertexes.size() > 0)
 			{
 				vertex& e = vertexes.top();
-				if ((processed_nodes.find(e.g_ptr_) == processed_nodes.end()) &&
+				if (!processed_nodes[storage.index(e.g_ptr_)] &&
 					(e.childs_processed_ < e.g_ptr_->get_num_of_children()))
 				{
 					auto* child = e.g_ptr_->get_child(e.childs_processed_);
-					if (auto op_child = dynamic_cast<op_node*>(child))
-						vertexes.push(op_child);
+					if (child->node_kind_ == NODE_KIND::OPERATION_GADGET)
+						vertexes.push(static_cast<op_node*>(child));
 					e.childs_processed_++;
 				}
 				else
 				{
-					if (processed_nodes.find(e.g_ptr_) != processed_nodes.end())
+					if (processed_nodes[storage.index(e.g_ptr_)])
 					{
 						vertexes.pop();
 						continue;
 					}
-					processed_nodes.insert(e.g_ptr_);
+					processed_nodes[storage.index(e.g_ptr_)] = true;
 					auto kind = e.g_ptr_->kind();
 					switch (kind)
 					{
@@ -220,6 +370,14 @@ namespace gadgetlib
 					{
 						auto* first_child = e.g_ptr_->get_child(0);
 						auto* second_child = e.g_ptr_->get_child(1);
+						if (kind == OP_KIND::PLUS && first_child->type_ == NODE_TYPE::FIXED_WIDTH_INTEGER_NODE)
+						{
+							//flattened: no wire until the value is used
+							node_metadata& metadata = storage[e.g_ptr_];
+							add_summand(pboard, storage, num_uses, first_child, metadata.pending_sum);
+							add_summand(pboard, storage, num_uses, second_child, metadata.pending_sum);
+							break;
+						}
 						var_index_t first_index = get_packed_var(pboard, storage, first_child);
 						var_index_t second_index = get_packed_var(pboard, storage, second_child);
 						var_index_t result_index = pboard.get_free_var();
@@ -257,8 +415,6 @@ namespace gadgetlib
 							auto& f_op_of = storage[first_child].overflowed;
 							auto& s_op_of = storage[second_child].overflowed;
 
-							if (kind == OP_KIND::PLUS)
-								metadata.overflowed = std::max(f_op_of, s_op_of) + 1;
 							if (kind == OP_KIND::MUL)
 								metadata.overflowed = f_op_of + s_op_of;
 						}
@@ -272,20 +428,17 @@ namespace gadgetlib
 					{
 						auto* first_child = e.g_ptr_->get_child(0);
 						auto* second_child = e.g_ptr_->get_child(1);
-						auto first_index_range = get_unpacked_var(pboard, storage, first_child);
-						auto second_index_range = get_unpacked_var(pboard, storage, second_child);
+						const auto& first_bits = get_unpacked_var(pboard, storage, first_child);
+						const auto& second_bits = get_unpacked_var(pboard, storage, second_child);
 						auto final_index_range = pboard.get_free_var_range(e.g_ptr_->bitsize_);
 
 						for (unsigned i = 0; i < e.g_ptr_->bitsize_; i++)
 						{
 							make_logical_constraint(pboard, e.g_ptr_->kind(),
-								first_index_range.first + i, second_index_range.first + i,
-								final_index_range.first + i);
+								first_bits[i], second_bits[i], final_index_range.first + i);
 						}
 
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.low_unpacked_index = final_index_range.first;
-						metadata.upper_unpacked_index = final_index_range.second;
+						storage[e.g_ptr_].bits = to_list(final_index_range);
 						break;
 					}
 					case (OP_KIND::EQ):
@@ -304,14 +457,13 @@ namespace gadgetlib
 						}
 						else
 						{
-							auto first_index_range = get_unpacked_var(pboard, storage, first_child);
-							auto second_index_range = get_unpacked_var(pboard, storage, second_child);
+							const auto& first_bits = get_unpacked_var(pboard, storage, first_child);
+							const auto& second_bits = get_unpacked_var(pboard, storage, second_child);
 
 							for (unsigned i = 0; i < first_child->bitsize_; i++)
 							{
-								pboard.add_r1cs_constraint(1,
-									pboard.idx2var(first_index_range.first + i),
-									pboard.idx2var(second_index_range.first + i));
+								pboard.add_r1cs_constraint(1, pboard.idx2var(first_bits[i]),
+									pboard.idx2var(second_bits[i]));
 							}
 						}
 
@@ -320,27 +472,13 @@ namespace gadgetlib
 					case (OP_KIND::INDEX):
 					{
 						auto* child = e.g_ptr_->get_child(0);
-						auto index_range = get_unpacked_var(pboard, storage, child);
+						const auto& bits = get_unpacked_var(pboard, storage, child);
 						uint32_t ub = e.g_ptr_->additional_param_;
 						uint32_t lb = e.g_ptr_->param_;
-						uint32_t final_length = ub - lb + 1;
-						auto final_index_range = pboard.get_free_var_range(final_length);
 						uint32_t start = child->bitsize_ - ub - 1;
 
-						for (unsigned i = 0; i < final_length; i++)
-						{
-							pboard.add_r1cs_constraint(1,
-								pboard.idx2var(index_range.first + start + i),
-								pboard.idx2var(final_index_range.first + i));
-
-							pboard.assignment[final_index_range.first + i] =
-								pboard.assignment[index_range.first + start + i];
-						}
-
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.low_unpacked_index = final_index_range.first;
-						metadata.upper_unpacked_index = final_index_range.second;
-
+						storage[e.g_ptr_].bits.assign(bits.begin() + start,
+							bits.begin() + start + (ub - lb + 1));
 						break;
 					}
 
@@ -348,129 +486,66 @@ namespace gadgetlib
 					{
 						auto* child = e.g_ptr_->get_child(0);
 						uint32_t shift = e.g_ptr_->param_;
-						auto index_range = get_unpacked_var(pboard, storage, child);
-						auto final_index_range = pboard.get_free_var_range(e.g_ptr_->bitsize_);
+						const auto& bits = get_unpacked_var(pboard, storage, child);
 
+						variable_list result;
+						result.reserve(e.g_ptr_->bitsize_);
 						for (unsigned i = 0; i < e.g_ptr_->bitsize_; i++)
-						{
-							auto j = index_range.first + i + shift;
-							if (j <= index_range.second)
-							{
-								pboard.add_r1cs_constraint(1, pboard.idx2var(j),
-									pboard.idx2var(final_index_range.first + i));
-
-								pboard.assignment[final_index_range.first + i] =
-									pboard.assignment[j];
-							}
-							else
-							{
-								pboard.add_r1cs_constraint(1,
-									pboard.idx2var(final_index_range.first + i), 0);
-								pboard.assignment[final_index_range.first + i] = 0;
-							}
-						}
-
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.low_unpacked_index = final_index_range.first;
-						metadata.upper_unpacked_index = final_index_range.second;
+							result.push_back(i + shift < bits.size() ? bits[i + shift] : pboard.zero_var());
 
+						storage[e.g_ptr_].bits = std::move(result);
 						break;
 					}
 					case (OP_KIND::NOT):
 					{
 						auto* child = e.g_ptr_->get_child(0);
-						auto index_range = get_unpacked_var(pboard, storage, child);
+						const auto& bits = get_unpacked_var(pboard, storage, child);
 
 						auto final_index_range = pboard.get_free_var_range(e.g_ptr_->bitsize_);
 
 						for (unsigned i = 0; i < e.g_ptr_->bitsize_; i++)
 						{
-							pboard.add_r1cs_constraint(1,
-								1 - pboard.idx2var(index_range.first + i),
+							pboard.add_r1cs_constraint(1, 1 - pboard.idx2var(bits[i]),
 								pboard.idx2var(final_index_range.first + i));
 
 							pboard.assignment[final_index_range.first + i] =
-								FieldT(1) - pboard.assignment[index_range.first + i];
+								FieldT(1) - pboard.assignment[bits[i]];
 						}
 
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.low_unpacked_index = final_index_range.first;
-						metadata.upper_unpacked_index = final_index_range.second;
+						storage[e.g_ptr_].bits = to_list(final_index_range);
 						break;
 					}
 					case (OP_KIND::ROTATE_LEFT):
 					case (OP_KIND::ROTATE_RIGHT):
 					{
 						auto* child = e.g_ptr_->get_child(0);
-						auto index_range = get_unpacked_var(pboard, storage, child);
+						const auto& bits = get_unpacked_var(pboard, storage, child);
+						uint32_t size = e.g_ptr_->bitsize_;
 						uint32_t shift = 
 							(e.g_ptr_->kind() == OP_KIND::ROTATE_RIGHT ? e.g_ptr_->param_ :
-							e.g_ptr_->bitsize_ - e.g_ptr_->param_);
-						auto final_index_range = pboard.get_free_var_range(e.g_ptr_->bitsize_);
-						auto k = index_range.first;
-
-						for (unsigned i = 0; i < e.g_ptr_->bitsize_; i++)
-						{
-							auto j = index_range.first + i + shift;
-
-							if (j <= index_range.second)
-							{
-								pboard.add_r1cs_constraint(1, pboard.idx2var(j),
-									pboard.idx2var(final_index_range.first + i));
-
-								pboard.assignment[final_index_range.first + i] =
-									pboard.assignment[j];
-							}
-							else
-							{
-								pboard.add_r1cs_constraint(1, pboard.idx2var(k),
-									pboard.idx2var(final_index_range.first + i));
+							size - e.g_ptr_->param_) % size;
 
-								pboard.assignment[final_index_range.first + i] =
-									pboard.assignment[k++];
-							}
-						}
+						variable_list result(size);
+						for (unsigned i = 0; i < size; i++)
+							result[i] = bits[(i + shift) % size];
 
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.low_unpacked_index = final_index_range.first;
-						metadata.upper_unpacked_index = final_index_range.second;
+						storage[e.g_ptr_].bits = std::move(result);
 						break;
 					}
 					case (OP_KIND::CONCATENATION):
 					{
+						//the second argument forms the low bits
 						auto* first_child = e.g_ptr_->get_child(0);
 						auto* second_child = e.g_ptr_->get_child(1);
-						auto first_index_range = get_unpacked_var(pboard, storage, first_child);
-						auto second_index_range = get_unpacked_var(pboard, storage, second_child);
-						auto final_index_range = pboard.get_free_var_range(e.g_ptr_->bitsize_);
-
-						for (unsigned i = 0; i < e.g_ptr_->bitsize_; i++)
-						{
-							if (i < second_child->bitsize_)
-							{
-								pboard.add_r1cs_constraint(1,
-									pboard.idx2var(final_index_range.first + i),
-									pboard.idx2var(second_index_range.first + i));
-
-								pboard.assignment[final_index_range.first + i] =
-									pboard.assignment[second_index_range.first + i];
-							}
-							else
-							{
-								auto j = i - second_child->bitsize_;
-								pboard.add_r1cs_constraint(1,
-									pboard.idx2var(final_index_range.first + i),
-									pboard.idx2var(first_index_range.first + j));
-
-								pboard.assignment[final_index_range.first + i] =
-									pboard.assignment[first_index_range.first + j];
-							}
-						}
+						const auto& first_bits = get_unpacked_var(pboard, storage, first_child);
+						const auto& second_bits = get_unpacked_var(pboard, storage, second_child);
 
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.low_unpacked_index = final_index_range.first;
-						metadata.upper_unpacked_index = final_index_range.second;
+						variable_list result;
+						result.reserve(e.g_ptr_->bitsize_);
+						result.insert(result.end(), second_bits.begin(), second_bits.end());
+						result.insert(result.end(), first_bits.begin(), first_bits.end());
 
+						storage[e.g_ptr_].bits = std::move(result);
 						break;
 					}
 					case (OP_KIND::ITE):
@@ -479,7 +554,7 @@ namespace gadgetlib
 						auto* first_child = e.g_ptr_->get_child(1);
 						auto* second_child = e.g_ptr_->get_child(2);
 						assert(condition->bitsize_ == 1 && "incorrect bitsize of condition");
-						auto condition_index = get_unpacked_var(pboard, storage, condition).first;
+						auto condition_index = get_unpacked_var(pboard, storage, condition)[0];
 
 						//if (true)
 						if (first_child->bitsize_ <= FieldT::safe_bitsize)
@@ -511,26 +586,23 @@ namespace gadgetlib
 						{
 							auto final_index_range = pboard.get_free_var_range(e.g_ptr_->bitsize_);
 
-							auto first_index_range = get_unpacked_var(pboard, storage, first_child);
-							auto second_index_range = get_unpacked_var(pboard, storage, second_child);
+							const auto& first_bits = get_unpacked_var(pboard, storage, first_child);
+							const auto& second_bits = get_unpacked_var(pboard, storage, second_child);
 
 							for (unsigned i = 0; i < e.g_ptr_->bitsize_; i++)
 							{
 								pboard.add_r1cs_constraint(pboard.idx2var(condition_index),
-									pboard.idx2var(first_index_range.first + i) -
-									pboard.idx2var(second_index_range.first + i),
+									pboard.idx2var(first_bits[i]) - pboard.idx2var(second_bits[i]),
 									pboard.idx2var(final_index_range.first + i) -
-									pboard.idx2var(second_index_range.first + i));
+									pboard.idx2var(second_bits[i]));
 
 								pboard.assignment[final_index_range.first + i] =
-									(pboard.assignment[condition_index + i] ?
-										pboard.assignment[first_index_range.first + i] : 
-											pboard.assignment[second_index_range.first + i]);
+									(pboard.assignment[condition_index] ?
+										pboard.assignment[first_bits[i]] : 
+											pboard.assignment[second_bits[i]]);
 							}
 
-							node_metadata& metadata = storage[e.g_ptr_];
-							metadata.low_unpacked_index = final_index_range.first;
-							metadata.upper_unpacked_index = final_index_range.second;
+							storage[e.g_ptr_].bits = to_list(final_index_range);
 						}
 
 						break;
@@ -545,12 +617,8 @@ namespace gadgetlib
 						var_index_t result_index = pboard.get_free_var();
 						auto bitsize = second_child->bitsize_ + 1;
 
-						FieldT power_of_two = 1;
 						//NB: subtle point, very weak
-						for (unsigned i = 0; i < bitsize-1; i++)
-						{
-							power_of_two *= 2;
-						}
+						const FieldT& power_of_two = pboard.power_of_two(bitsize - 1);
 
 						pboard.add_r1cs_constraint({ pb_variable<FieldT>(0),
 							power_of_two * pb_variable<FieldT>(0), pb_variable<FieldT>(first_index) + 
@@ -598,8 +666,7 @@ namespace gadgetlib
 							auto y = pboard.assignment[second_index];
 							FieldT flag = FieldT(x == y, true);
 							pboard.assignment[result_index] = flag;
-							FieldT sum = flag + x - y;
-							pboard.assignment[inverse_index] = sum.inverse();
+							pending_inverses.emplace_back(inverse_index, flag + x - y);
 							pboard.add_r1cs_constraint(pboard.idx2var(inverse_index),
 								pboard.idx2var(result_index) + pboard.idx2var(first_index) - pboard.idx2var(second_index), 
 								pboard.idx2var(0));
@@ -636,17 +703,19 @@ namespace gadgetlib
 					}
 					case (OP_KIND::EXTEND):
 					{
+						//same value on more bits: reuse the bits padded with zeros, or the
+						//packed wire once the overflow is reduced
 						auto* child = e.g_ptr_->get_child(0);
-						var_index_t input_index = get_packed_var(pboard, storage, child, true);
-						var_index_t result_index = pboard.get_free_var();
-
-						pboard.add_r1cs_constraint(1, pboard.idx2var(result_index),
-							pboard.idx2var(input_index));
-						pboard.assignment[result_index] = pboard.assignment[input_index];
-
-
-						node_metadata& metadata = storage[e.g_ptr_];
-						metadata.packed_index = result_index;
+						const node_metadata& child_metadata = storage[child];
+						if (child_metadata.packed_index == 0 && !child_metadata.bits.empty())
+						{
+							variable_list result = child_metadata.bits;
+							result.resize(e.g_ptr_->bitsize_, pboard.zero_var());
+							storage[e.g_ptr_].bits = std::move(result);
+						}
+						else
+							storage[e.g_ptr_].packed_index =
+								get_packed_var(pboard, storage, child, true);
 						break;
 					}
 					default:
@@ -659,6 +728,10 @@ namespace gadgetlib
 					vertexes.pop();
 				}
 			}
+
+			//a sum at the root is never asked for its value by a parent
+			materialize_sum(pboard, storage[g.node_]);
+			fill_inverses(pboard, pending_inverses);
 		}
 	};
 }
@@ -0,0 +1,239 @@
+#ifndef CHUNKED_ASSIGNMENT_HPP_
+#define CHUNKED_ASSIGNMENT_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <type_traits>
+#include <cassert>
+
+#include "mapped_file.hpp"
+
+namespace gadgetlib
+{
+	/**
+	* Witness storage split into fixed-size chunks. Elements never move once allocated, so
+	* growing the assignment costs no copies and references to elements stay valid.
+	*
+	* In spill mode (trivially copyable field types only) chunks live in a memory-mapped
+	* scratch file. resident_chunks is a soft limit: it is enforced only when a chunk is
+	* allocated (the chunk that falls out of the most recent resident_chunks is written back
+	* to the file and dropped from RAM) and by evict_cold_chunks. Random access through
+	* operator[] pages evicted chunks back in and does not evict anything, so callers that
+	* revisit old chunks should call evict_cold_chunks afterwards to trim RAM again.
+	*/
+	template<typename FieldT>
+	class chunked_assignment
+	{
+	public:
+		static constexpr unsigned CHUNK_BITS = 14;
+		static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+
+		chunked_assignment() = default;
+
+		chunked_assignment(const chunked_assignment& other)
+		{
+			*this = other;
+		}
+
+		chunked_assignment(chunked_assignment&& other)
+		{
+			*this = std::move(other);
+		}
+
+		chunked_assignment& operator=(const chunked_assignment& other)
+		{
+			if (this == &other)
+				return *this;
+			release();
+			if constexpr (std::is_trivially_copyable<FieldT>::value)
+			{
+				if (other.spill_)
+					enable_spill(other.spill_directory_, other.resident_chunks_);
+			}
+			resize(other.size_);
+			for (size_t i = 0; i < chunks_.size(); i++)
+			{
+				size_t count = std::min(CHUNK_SIZE, size_ - i * CHUNK_SIZE);
+				std::copy(other.chunks_[i], other.chunks_[i] + count, chunks_[i]);
+			}
+			return *this;
+		}
+
+		chunked_assignment& operator=(chunked_assignment&& other)
+		{
+			if (this == &other)
+				return *this;
+			release();
+			chunks_ = std::move(other.chunks_);
+			owned_ = std::move(other.owned_);
+			size_ = other.size_;
+			spill_ = std::move(other.spill_);
+			spill_directory_ = std::move(other.spill_directory_);
+			resident_chunks_ = other.resident_chunks_;
+			chunk_bytes_ = other.chunk_bytes_;
+			other.chunks_.clear();
+			other.owned_.clear();
+			other.size_ = 0;
+			return *this;
+		}
+
+		~chunked_assignment()
+		{
+			release();
+		}
+
+		size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		bool is_spilled() const { return (bool)spill_; }
+
+		FieldT& operator[](size_t idx)
+		{
+			return chunks_[idx >> CHUNK_BITS][idx & (CHUNK_SIZE - 1)];
+		}
+
+		const FieldT& operator[](size_t idx) const
+		{
+			return chunks_[idx >> CHUNK_BITS][idx & (CHUNK_SIZE - 1)];
+		}
+
+		template<typename... Args>
+		void emplace_back(Args&&... args)
+		{
+			if (size_ == chunks_.size() * CHUNK_SIZE)
+				add_chunk();
+			(*this)[size_] = FieldT(std::forward<Args>(args)...);
+			size_++;
+		}
+
+		void resize(size_t size)
+		{
+			while (chunks_.size() * CHUNK_SIZE < size)
+				add_chunk();
+			for (size_t idx = size_; idx < size; idx++)
+				(*this)[idx] = FieldT();
+			size_ = size;
+		}
+
+		/**
+		* Calls func(ptr, len, offset) for each contiguous piece of [first, first + count):
+		* ptr points to element first + offset, and the piece has len elements.
+		*/
+		template<typename Func>
+		void for_each_segment(size_t first, size_t count, Func&& func)
+		{
+			size_t offset = 0;
+			while (count > 0)
+			{
+				size_t len = std::min(count, CHUNK_SIZE - (first & (CHUNK_SIZE - 1)));
+				func(&(*this)[first], len, offset);
+				first += len;
+				offset += len;
+				count -= len;
+			}
+		}
+
+		/**
+		* Moves the storage to an anonymous memory-mapped file in directory, evicting chunks
+		* beyond the most recent resident_chunks as new ones are allocated (see the class
+		* comment: this is not a hard bound). Elements already stored are copied over once;
+		* from then on their addresses are stable.
+		*/
+		void enable_spill(const std::string& directory, size_t resident_chunks)
+		{
+			static_assert(std::is_trivially_copyable<FieldT>::value,
+				"spill mode requires a trivially copyable field type");
+			assert(resident_chunks > 0);
+
+			std::vector<FieldT*> old_chunks = std::move(chunks_);
+			std::vector<std::unique_ptr<FieldT[]>> old_owned = std::move(owned_);
+			chunks_.clear();
+			owned_.clear();
+
+			size_t granularity = utils::mapped_file::granularity();
+			chunk_bytes_ = (CHUNK_SIZE * sizeof(FieldT) + granularity - 1) / granularity *
+				granularity;
+			spill_.reset(new utils::mapped_file(
+				utils::mapped_file::create_temporary(directory)));
+			spill_directory_ = directory;
+			resident_chunks_ = resident_chunks;
+
+			for (auto* old_chunk : old_chunks)
+			{
+				add_chunk();
+				std::copy(old_chunk, old_chunk + CHUNK_SIZE, chunks_.back());
+			}
+		}
+
+		//empty assignment stored the same way as this one, i.e. spilled to the same directory
+		//if this one is
+		chunked_assignment empty_like() const
+		{
+			chunked_assignment result;
+			if constexpr (std::is_trivially_copyable<FieldT>::value)
+			{
+				if (spill_)
+					result.enable_spill(spill_directory_, resident_chunks_);
+			}
+			return result;
+		}
+
+		//drops every chunk but the most recent resident_chunks ones from RAM, including
+		//chunks paged back in by operator[] since they were last evicted
+		void evict_cold_chunks()
+		{
+			if (!spill_)
+				return;
+			for (size_t i = 0; i + resident_chunks_ < chunks_.size(); i++)
+				utils::mapped_file::evict(chunks_[i], chunk_bytes_);
+		}
+
+	private:
+		std::vector<FieldT*> chunks_;
+		//in-memory chunks; spilled chunks are views of spill_ and have no entry here
+		std::vector<std::unique_ptr<FieldT[]>> owned_;
+		size_t size_ = 0;
+
+		std::unique_ptr<utils::mapped_file> spill_;
+		std::string spill_directory_;
+		size_t resident_chunks_ = 0;
+		size_t chunk_bytes_ = 0;
+
+		void add_chunk()
+		{
+			if (!spill_)
+			{
+				owned_.emplace_back(new FieldT[CHUNK_SIZE]);
+				chunks_.push_back(owned_.back().get());
+				return;
+			}
+
+			uint64_t offset = (uint64_t)chunks_.size() * chunk_bytes_;
+			spill_->resize(offset + chunk_bytes_);
+			FieldT* chunk = static_cast<FieldT*>(spill_->map(offset, chunk_bytes_));
+			std::uninitialized_fill(chunk, chunk + CHUNK_SIZE, FieldT());
+			chunks_.push_back(chunk);
+			if (chunks_.size() > resident_chunks_)
+				utils::mapped_file::evict(chunks_[chunks_.size() - resident_chunks_ - 1],
+					chunk_bytes_);
+		}
+
+		void release()
+		{
+			if (spill_)
+			{
+				for (auto* chunk : chunks_)
+					utils::mapped_file::unmap(chunk, chunk_bytes_);
+				spill_.reset();
+			}
+			chunks_.clear();
+			owned_.clear();
+			size_ = 0;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef CONSTRAINT_SINKS_HPP_
+#define CONSTRAINT_SINKS_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <iterator>
+
+#include "protoboard.hpp"
+#include "r1cs_export.hpp"
+
+namespace gadgetlib
+{
+	/**
+	* Keeps the constraints in memory, in the same form as protoboard::constraints_.
+	*/
+	template<typename FieldT>
+	class r1cs_memory_sink : public r1cs_constraint_sink<FieldT>
+	{
+	public:
+		void add_constraint(pb_linear_combination<FieldT>&& a, pb_linear_combination<FieldT>&& b,
+			pb_linear_combination<FieldT>&& c) override
+		{
+			system_.add_constraint(std::move(a), std::move(b), std::move(c));
+		}
+
+		const r1cs_constraint_system<FieldT>& system() const { return system_; }
+		r1cs_constraint_system<FieldT> release() { return std::move(system_); }
+
+	private:
+		r1cs_constraint_system<FieldT> system_;
+	};
+
+	/**
+	* Drops the constraints and only keeps statistics - for sizing a circuit.
+	*/
+	template<typename FieldT>
+	class r1cs_counting_sink : public r1cs_constraint_sink<FieldT>
+	{
+	public:
+		void add_constraint(pb_linear_combination<FieldT>&& a, pb_linear_combination<FieldT>&& b,
+			pb_linear_combination<FieldT>&& c) override
+		{
+			num_constraints_++;
+			num_terms_ += a.size() + b.size() + c.size();
+		}
+
+		size_t num_constraints() const { return num_constraints_; }
+		size_t num_terms() const { return num_terms_; }
+
+	private:
+		size_t num_constraints_ = 0;
+		size_t num_terms_ = 0;
+	};
+
+	/**
+	* Hands every constraint to a user function.
+	*/
+	template<typename FieldT>
+	class r1cs_callback_sink : public r1cs_constraint_sink<FieldT>
+	{
+	public:
+		using callback_t = std::function<void(const pb_linear_combination<FieldT>&,
+			const pb_linear_combination<FieldT>&, const pb_linear_combination<FieldT>&)>;
+
+		explicit r1cs_callback_sink(callback_t callback) : callback_(std::move(callback)) {}
+
+		void add_constraint(pb_linear_combination<FieldT>&& a, pb_linear_combination<FieldT>&& b,
+			pb_linear_combination<FieldT>&& c) override
+		{
+			callback_(a, b, c);
+		}
+
+	private:
+		callback_t callback_;
+	};
+
+	/**
+	* Streams the constraints to a binary file as they are generated. Each linear combination
+	* is written as a uint32 term count followed by (uint32 wire index, coefficient) pairs,
+	* with coefficients padded to iden3_detail::field_width bytes - the record layout of the
+	* constraints section of iden3 .r1cs files. The file holds these records only: there is
+	* no header or wire map, and wires are numbered as on the protoboard. Read it back with
+	* read_r1cs_stream. Write failures are reported with std::runtime_error.
+	*/
+	template<typename FieldT>
+	class r1cs_file_sink : public r1cs_constraint_sink<FieldT>
+	{
+	public:
+		explicit r1cs_file_sink(const std::string& path) :
+			out_(path), width_(iden3_detail::field_width<FieldT>())
+		{
+		}
+
+		void add_constraint(pb_linear_combination<FieldT>&& a, pb_linear_combination<FieldT>&& b,
+			pb_linear_combination<FieldT>&& c) override
+		{
+			write_lc(a);
+			write_lc(b);
+			write_lc(c);
+			num_constraints_++;
+			if (!out_.good())
+				throw std::runtime_error("r1cs_file_sink: write failed");
+		}
+
+		void close()
+		{
+			out_.close();
+		}
+
+		size_t num_constraints() const { return num_constraints_; }
+
+	private:
+		iden3_detail::binary_writer out_;
+		size_t width_;
+		size_t num_constraints_ = 0;
+
+		void write_lc(const pb_linear_combination<FieldT>& lc)
+		{
+			out_.write_uint32((uint32_t)lc.size());
+			for (const auto& term : lc)
+			{
+				assert(term.index <= std::numeric_limits<uint32_t>::max());
+				out_.write_uint32((uint32_t)term.index);
+				out_.write_field(term.coeff, width_);
+			}
+		}
+	};
+
+	/**
+	* Reads back a file written by r1cs_file_sink. Throws std::runtime_error if the file cannot
+	* be read or ends in the middle of a constraint.
+	*/
+	template<typename FieldT>
+	r1cs_constraint_system<FieldT> read_r1cs_stream(const std::string& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			throw std::runtime_error("read_r1cs_stream: cannot open " + path);
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (in.bad())
+			throw std::runtime_error("read_r1cs_stream: read failed");
+
+		const size_t width = iden3_detail::field_width<FieldT>();
+		const uint8_t* pos = data.data();
+		const uint8_t* end = data.data() + data.size();
+		r1cs_constraint_system<FieldT> result;
+		while (pos != end)
+		{
+			pb_linear_combination<FieldT> a, b, c;
+			pos = iden3_detail::read_linear_combination(pos, end, width, a);
+			pos = iden3_detail::read_linear_combination(pos, end, width, b);
+			pos = iden3_detail::read_linear_combination(pos, end, width, c);
+			result.add_constraint(std::move(a), std::move(b), std::move(c));
+		}
+		return result;
+	}
+}
+
+#endif
@@ -0,0 +1,379 @@
+#ifndef FIELD_KERNELS_HPP_
+#define FIELD_KERNELS_HPP_
+
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+#include <cassert>
+
+#include "montgomery_field.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define GADGETLIB_HAS_AVX2_KERNEL
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GADGETLIB_AVX2_TARGET
+#else
+#define GADGETLIB_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace gadgetlib
+{
+	enum class kernel_backend
+	{
+		AUTO,
+		SCALAR,
+		AVX2
+	};
+
+	namespace kernel_detail
+	{
+		//the vector kernels work on 256-bit moduli split into 32-bit words,
+		//so that every partial product fits into a 64-bit lane of _mm256_mul_epu32
+		static constexpr unsigned WORDS = 8;
+		static constexpr unsigned LANES = 4;
+
+		struct word_params
+		{
+			uint32_t modulus[WORDS];
+			//-p^(-1) mod 2^32
+			uint32_t inv;
+		};
+
+		inline bool cpu_has_avx2()
+		{
+#if !defined(GADGETLIB_HAS_AVX2_KERNEL)
+			return false;
+#elif defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+			__cpuid(info, 1);
+			//OSXSAVE and AVX, then check that the OS saves ymm state
+			if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+				return false;
+			if ((_xgetbv(0) & 6) != 6)
+				return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			return __builtin_cpu_supports("avx2");
+#endif
+		}
+
+		inline bool use_avx2(kernel_backend backend)
+		{
+			static const bool avx2_available = cpu_has_avx2();
+			switch (backend)
+			{
+			case kernel_backend::AVX2:
+				assert(avx2_available && "AVX2 is not supported on this CPU");
+				return true;
+			case kernel_backend::SCALAR:
+				return false;
+			default:
+				return avx2_available;
+			};
+		}
+
+#ifdef GADGETLIB_HAS_AVX2_KERNEL
+		//if (hi, t) >= p, replace t with t - p; hi is the carry word above t
+		GADGETLIB_AVX2_TARGET
+		inline void avx2_reduce_once(__m256i* t, __m256i hi, const word_params& params)
+		{
+			const __m256i mask = _mm256_set1_epi64x(0xffffffff);
+			__m256i diff[WORDS];
+			__m256i borrow = _mm256_setzero_si256();
+			for (unsigned j = 0; j < WORDS; j++)
+			{
+				__m256i d = _mm256_sub_epi64(t[j], _mm256_set1_epi64x(params.modulus[j]));
+				d = _mm256_sub_epi64(d, borrow);
+				diff[j] = _mm256_and_si256(d, mask);
+				borrow = _mm256_srli_epi64(d, 63);
+			}
+			__m256i keep_diff = _mm256_or_si256(_mm256_cmpeq_epi64(borrow, _mm256_setzero_si256()),
+				_mm256_cmpgt_epi64(hi, _mm256_setzero_si256()));
+			for (unsigned j = 0; j < WORDS; j++)
+				t[j] = _mm256_blendv_epi8(t[j], diff[j], keep_diff);
+		}
+
+		GADGETLIB_AVX2_TARGET
+		inline void avx2_load(__m256i* dst, const uint32_t* const* src, size_t offset)
+		{
+			for (unsigned j = 0; j < WORDS; j++)
+				dst[j] = _mm256_cvtepu32_epi64(
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(src[j] + offset)));
+		}
+
+		GADGETLIB_AVX2_TARGET
+		inline void avx2_store(uint32_t* const* dst, const __m256i* src, size_t offset)
+		{
+			//gather the low halves of the four 64-bit lanes into one 128-bit word
+			const __m256i pick_low = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+			for (unsigned j = 0; j < WORDS; j++)
+			{
+				__m256i packed = _mm256_permutevar8x32_epi32(src[j], pick_low);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst[j] + offset),
+					_mm256_castsi256_si128(packed));
+			}
+		}
+
+		GADGETLIB_AVX2_TARGET
+		inline void avx2_add(uint32_t* const* out, const uint32_t* const* a,
+			const uint32_t* const* b, size_t count, const word_params& params)
+		{
+			const __m256i mask = _mm256_set1_epi64x(0xffffffff);
+			for (size_t i = 0; i < count; i += LANES)
+			{
+				__m256i x[WORDS], y[WORDS];
+				avx2_load(x, a, i);
+				avx2_load(y, b, i);
+				__m256i carry = _mm256_setzero_si256();
+				for (unsigned j = 0; j < WORDS; j++)
+				{
+					__m256i s = _mm256_add_epi64(_mm256_add_epi64(x[j], y[j]), carry);
+					x[j] = _mm256_and_si256(s, mask);
+					carry = _mm256_srli_epi64(s, 32);
+				}
+				avx2_reduce_once(x, carry, params);
+				avx2_store(out, x, i);
+			}
+		}
+
+		//CIOS Montgomery multiplication, four independent products per iteration
+		GADGETLIB_AVX2_TARGET
+		inline void avx2_mul(uint32_t* const* out, const uint32_t* const* a,
+			const uint32_t* const* b, size_t count, const word_params& params)
+		{
+			const __m256i mask = _mm256_set1_epi64x(0xffffffff);
+			const __m256i inv = _mm256_set1_epi64x(params.inv);
+			__m256i p[WORDS];
+			for (unsigned j = 0; j < WORDS; j++)
+				p[j] = _mm256_set1_epi64x(params.modulus[j]);
+
+			for (size_t i = 0; i < count; i += LANES)
+			{
+				__m256i x[WORDS], y[WORDS];
+				avx2_load(x, a, i);
+				if (a[0] == b[0])
+					for (unsigned j = 0; j < WORDS; j++)
+						y[j] = x[j];
+				else
+					avx2_load(y, b, i);
+
+				//every lane of t holds a 32-bit word, so t[j] + x * y + carry fits 64 bits
+				__m256i t[WORDS + 2];
+				for (unsigned j = 0; j < WORDS + 2; j++)
+					t[j] = _mm256_setzero_si256();
+
+				for (unsigned k = 0; k < WORDS; k++)
+				{
+					__m256i carry = _mm256_setzero_si256();
+					for (unsigned j = 0; j < WORDS; j++)
+					{
+						__m256i s = _mm256_add_epi64(t[j], _mm256_mul_epu32(x[j], y[k]));
+						s = _mm256_add_epi64(s, carry);
+						t[j] = _mm256_and_si256(s, mask);
+						carry = _mm256_srli_epi64(s, 32);
+					}
+					__m256i s = _mm256_add_epi64(t[WORDS], carry);
+					t[WORDS] = _mm256_and_si256(s, mask);
+					t[WORDS + 1] = _mm256_srli_epi64(s, 32);
+
+					__m256i m = _mm256_and_si256(_mm256_mul_epu32(t[0], inv), mask);
+					s = _mm256_add_epi64(t[0], _mm256_mul_epu32(m, p[0]));
+					carry = _mm256_srli_epi64(s, 32);
+					for (unsigned j = 1; j < WORDS; j++)
+					{
+						s = _mm256_add_epi64(t[j], _mm256_mul_epu32(m, p[j]));
+						s = _mm256_add_epi64(s, carry);
+						t[j - 1] = _mm256_and_si256(s, mask);
+						carry = _mm256_srli_epi64(s, 32);
+					}
+					s = _mm256_add_epi64(t[WORDS], carry);
+					t[WORDS - 1] = _mm256_and_si256(s, mask);
+					t[WORDS] = _mm256_add_epi64(t[WORDS + 1], _mm256_srli_epi64(s, 32));
+				}
+				avx2_reduce_once(t, t[WORDS], params);
+				avx2_store(out, t, i);
+			}
+		}
+#endif
+	}
+
+	/**
+	* Structure-of-arrays storage for MontgomeryField elements of a 256-bit modulus:
+	* word k of element i lives at word(k)[i], which lets the batch kernels below
+	* process several elements per instruction. The length is padded to a whole
+	* number of vector lanes with zeros (which are valid field elements).
+	*/
+	template<typename T>
+	class field_batch
+	{
+	public:
+		using field_type = MontgomeryField<T>;
+		static_assert(field_type::LIMBS * 2 == kernel_detail::WORDS,
+			"batch kernels support 4-limb moduli only");
+
+		field_batch(size_t size = 0)
+		{
+			resize(size);
+		}
+
+		size_t size() const
+		{
+			return size_;
+		}
+
+		size_t padded_size() const
+		{
+			return words_[0].size();
+		}
+
+		void resize(size_t size)
+		{
+			size_ = size;
+			size_t padded = (size + kernel_detail::LANES - 1) / kernel_detail::LANES *
+				kernel_detail::LANES;
+			for (auto& w : words_)
+				w.resize(padded, 0);
+		}
+
+		field_type get(size_t idx) const
+		{
+			typename field_type::limbs_type limbs;
+			for (unsigned i = 0; i < field_type::LIMBS; i++)
+				limbs[i] = (uint64_t)words_[2 * i][idx] | ((uint64_t)words_[2 * i + 1][idx] << 32);
+			return field_type::from_montgomery_limbs(limbs);
+		}
+
+		void set(size_t idx, const field_type& val)
+		{
+			auto& limbs = val.montgomery_limbs();
+			for (unsigned i = 0; i < field_type::LIMBS; i++)
+			{
+				words_[2 * i][idx] = (uint32_t)limbs[i];
+				words_[2 * i + 1][idx] = (uint32_t)(limbs[i] >> 32);
+			}
+		}
+
+		uint32_t* word(unsigned k)
+		{
+			return words_[k].data();
+		}
+
+		const uint32_t* word(unsigned k) const
+		{
+			return words_[k].data();
+		}
+
+	private:
+		size_t size_ = 0;
+		std::vector<uint32_t> words_[kernel_detail::WORDS];
+	};
+
+	namespace kernel_detail
+	{
+		template<typename T>
+		word_params make_word_params()
+		{
+			auto& params = MontgomeryField<T>::parameters();
+			word_params result;
+			for (unsigned i = 0; i < MontgomeryField<T>::LIMBS; i++)
+			{
+				result.modulus[2 * i] = (uint32_t)params.modulus[i];
+				result.modulus[2 * i + 1] = (uint32_t)(params.modulus[i] >> 32);
+			}
+			result.inv = (uint32_t)params.inv;
+			return result;
+		}
+
+		template<typename T>
+		std::array<const uint32_t*, WORDS> word_ptrs(const field_batch<T>& batch)
+		{
+			std::array<const uint32_t*, WORDS> result;
+			for (unsigned k = 0; k < WORDS; k++)
+				result[k] = batch.word(k);
+			return result;
+		}
+
+		template<typename T>
+		std::array<uint32_t*, WORDS> word_ptrs(field_batch<T>& batch)
+		{
+			std::array<uint32_t*, WORDS> result;
+			for (unsigned k = 0; k < WORDS; k++)
+				result[k] = batch.word(k);
+			return result;
+		}
+
+		template<typename T, typename Op>
+		void scalar_apply(field_batch<T>& out, const field_batch<T>& a, const field_batch<T>& b,
+			Op op)
+		{
+			for (size_t i = 0; i < a.size(); i++)
+			{
+				auto x = a.get(i);
+				op(x, b.get(i));
+				out.set(i, x);
+			}
+		}
+	}
+
+	//out[i] = a[i] + b[i]; out may alias a or b
+	template<typename T>
+	void batch_add(field_batch<T>& out, const field_batch<T>& a, const field_batch<T>& b,
+		kernel_backend backend = kernel_backend::AUTO)
+	{
+		assert(a.size() == b.size());
+		out.resize(a.size());
+#ifdef GADGETLIB_HAS_AVX2_KERNEL
+		if (kernel_detail::use_avx2(backend))
+		{
+			static const kernel_detail::word_params params = kernel_detail::make_word_params<T>();
+			auto o = kernel_detail::word_ptrs(out);
+			auto x = kernel_detail::word_ptrs(a);
+			auto y = kernel_detail::word_ptrs(b);
+			kernel_detail::avx2_add(o.data(), x.data(), y.data(), a.padded_size(), params);
+			return;
+		}
+#endif
+		kernel_detail::scalar_apply(out, a, b,
+			[](MontgomeryField<T>& x, const MontgomeryField<T>& y) { x += y; });
+	}
+
+	//out[i] = a[i] * b[i]; out may alias a or b
+	template<typename T>
+	void batch_mul(field_batch<T>& out, const field_batch<T>& a, const field_batch<T>& b,
+		kernel_backend backend = kernel_backend::AUTO)
+	{
+		assert(a.size() == b.size());
+		out.resize(a.size());
+#ifdef GADGETLIB_HAS_AVX2_KERNEL
+		if (kernel_detail::use_avx2(backend))
+		{
+			static const kernel_detail::word_params params = kernel_detail::make_word_params<T>();
+			auto o = kernel_detail::word_ptrs(out);
+			auto x = kernel_detail::word_ptrs(a);
+			auto y = kernel_detail::word_ptrs(b);
+			kernel_detail::avx2_mul(o.data(), x.data(), y.data(), a.padded_size(), params);
+			return;
+		}
+#endif
+		kernel_detail::scalar_apply(out, a, b,
+			[](MontgomeryField<T>& x, const MontgomeryField<T>& y) { x *= y; });
+	}
+
+	//out[i] = a[i] * a[i]
+	template<typename T>
+	void batch_square(field_batch<T>& out, const field_batch<T>& a,
+		kernel_backend backend = kernel_backend::AUTO)
+	{
+		batch_mul(out, a, a, backend);
+	}
+}
+
+#endif
@@ -7,7 +7,15 @@
 #include <memory>
 #include <cassert>
 #include <vector>
-#include <boost/variant.hpp>
+#include <array>
+#include <unordered_map>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <boost/container/small_vector.hpp>
 
 namespace gadgetlib
 {
@@ -59,39 +67,174 @@ namespace gadgetlib
 		EXTEND
 	};
 
+	class node_arena;
+	class op_node;
+
+	//index of a node in its arena
+	using node_handle = uint32_t;
+	constexpr node_handle NULL_NODE = std::numeric_limits<node_handle>::max();
+
 	class abstract_node
 	{
+	private:
+		friend class node_arena;
 	public:
+		//handle of the node in its arena (set by the arena), so per-node data can be kept in
+		//vectors
+		node_handle id_ = NULL_NODE;
+		node_arena* arena_ = nullptr;
+		//which subclass this is (operation, input or constant), to avoid dynamic_cast
+		const NODE_KIND node_kind_;
 		uint32_t bitsize_;
 		NODE_TYPE type_;
 	protected:		
-		abstract_node(uint32_t bitsize = 0, 
+		abstract_node(NODE_KIND node_kind, uint32_t bitsize = 0, 
 			NODE_TYPE type = NODE_TYPE::FIXED_WIDTH_INTEGER_NODE) :
-			bitsize_(bitsize), type_(type) {};
+			node_kind_(node_kind), bitsize_(bitsize), type_(type) {};
 	public:	
-		virtual ~abstract_node() = default;		
+		virtual ~abstract_node() = default;
+	};
+
+	/**
+	* Owns gadget nodes. They are placed one after another in large blocks and refer to their
+	* children by handles into the arena rather than by shared pointers, so building a node
+	* costs no refcounting and the whole graph is freed at once, without recursing through
+	* long chains of destructors. Each thread builds gadgets in its own current arena: by
+	* default one living as long as the thread, or the one of the innermost node_arena::scope.
+	* A gadget graph must not mix nodes of different arenas: building an operation from a
+	* gadget of another arena, or of one cleared or freed since, throws.
+	*/
+	class node_arena
+	{
+	public:
+		class scope;
+
+		node_arena();
+		node_arena(const node_arena&) = delete;
+		node_arena& operator=(const node_arena&) = delete;
+		~node_arena();
+
+		template<typename NodeT, typename... Args>
+		NodeT* make(Args&&... args)
+		{
+			assert(nodes_.size() < NULL_NODE);
+			void* memory = allocate(sizeof(NodeT), alignof(NodeT));
+			NodeT* node = new (memory) NodeT(std::forward<Args>(args)...);
+			node->id_ = (node_handle)nodes_.size();
+			node->arena_ = this;
+			nodes_.push_back(node);
+			return node;
+		}
+
+		abstract_node* get(node_handle handle) const
+		{
+			assert(handle < nodes_.size());
+			return nodes_[handle];
+		}
+
+		//all handles of the arena are below this bound
+		uint32_t size() const { return (uint32_t)nodes_.size(); }
+
+		//destroys every node - gadgets built in the arena must not be used afterwards
+		void clear();
+
+		//unique among all arenas ever made and renewed by clear(), so a gadget can tell
+		//whether the nodes it was built from are still there
+		uint64_t generation() const { return generation_; }
+		//whether the arena of this generation exists and has not been cleared since
+		static bool is_live(uint64_t generation);
+
+		/**
+		* With interning on, an operation with the same kind, operands and parameters as one
+		* already in the arena (operands of commutative operations taken in either order)
+		* is not built again - the existing node is returned, so the engraver lowers the
+		* shared subexpression once. Inputs and constants are never merged.
+		*/
+		void enable_interning(bool enable) { interning_ = enable; }
+		//operations that were served from the table instead of being built
+		size_t num_interned() const { return num_interned_; }
+
+		//places node into the arena, or returns its interned twin
+		abstract_node* intern(const op_node& node);
+
+		//the arena gadgets are built in by the calling thread
+		static node_arena& current();
+
+	private:
+		static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+		//op kind, the three children and the two parameters
+		using op_key = std::array<uint32_t, 6>;
+		struct op_key_hash
+		{
+			size_t operator()(const op_key& key) const
+			{
+				uint64_t result = 0;
+				for (uint32_t val : key)
+					result = (result ^ val) * 0x100000001b3ull;
+				return (size_t)(result ^ (result >> 32));
+			}
+		};
+
+		std::vector<abstract_node*> nodes_;
+		std::vector<std::unique_ptr<char[]>> blocks_;
+		size_t block_used_ = BLOCK_SIZE;
+		bool interning_ = false;
+		std::unordered_map<op_key, node_handle, op_key_hash> interned_;
+		size_t num_interned_ = 0;
+		uint64_t generation_;
+
+		void destroy_nodes();
+		void* allocate(size_t size, size_t alignment);
+		static node_arena*& current_ptr();
 	};
 
+	/**
+	* Makes a fresh arena current for the calling thread until the end of the scope, then
+	* frees it together with every gadget built meanwhile.
+	*/
+	class node_arena::scope
+	{
+	public:
+		scope() : previous_(current_ptr()) { current_ptr() = &arena_; }
+		~scope() { current_ptr() = previous_; }
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+		node_arena& arena() { return arena_; }
+
+	private:
+		node_arena arena_;
+		node_arena* previous_;
+	};
 	
 	class op_node : public abstract_node
 	{
 	private:
 		friend class gadget;
+
+		static node_handle handle_of(const abstract_node* child)
+		{
+			//operands have to live in the arena the operation is built in
+			if (child->arena_ != &node_arena::current())
+				throw std::runtime_error("gadget: operand built in another node arena");
+			return child->id_;
+		}
 	public:
 		OP_KIND op_kind_;
 
-		std::shared_ptr<abstract_node> first_child_ = nullptr;
-		std::shared_ptr<abstract_node> second_child_ = nullptr;
-		//TODO: optimize it later - may be using variant
-		std::shared_ptr<abstract_node> third_child_ = nullptr;
+		node_handle first_child_ = NULL_NODE;
+		node_handle second_child_ = NULL_NODE;
+		node_handle third_child_ = NULL_NODE;
 		uint32_t param_ = 0;
 		uint32_t additional_param_ = 0;
 
-		op_node(OP_KIND op_kind, std::shared_ptr<abstract_node> first_child,
-			std::shared_ptr<abstract_node> second_child = nullptr) : op_kind_(op_kind), 
-			first_child_(first_child), second_child_(second_child) 
+		op_node(OP_KIND op_kind, const abstract_node* first_child,
+			const abstract_node* second_child) :
+			abstract_node(NODE_KIND::OPERATION_GADGET), op_kind_(op_kind), 
+			first_child_(handle_of(first_child)), second_child_(handle_of(second_child)) 
 		{
-			assert(first_child->type_ == second_child_->type_);
+			assert(first_child->type_ == second_child->type_);
 			type_ = first_child->type_;
 			if (op_kind == OP_KIND::CONCATENATION)
 				bitsize_ = first_child->bitsize_ + second_child->bitsize_;
@@ -109,18 +252,18 @@ namespace gadgetlib
 			}
 		};
 
-		op_node(std::shared_ptr<abstract_node> first_child,
-			std::shared_ptr<abstract_node> second_child,
-			std::shared_ptr<abstract_node> third_child) : op_kind_(OP_KIND::ITE),
-			first_child_(first_child), second_child_(second_child),
-			third_child_(third_child)
+		op_node(const abstract_node* first_child, const abstract_node* second_child,
+			const abstract_node* third_child) :
+			abstract_node(NODE_KIND::OPERATION_GADGET), op_kind_(OP_KIND::ITE),
+			first_child_(handle_of(first_child)), second_child_(handle_of(second_child)),
+			third_child_(handle_of(third_child))
 		{
 			bitsize_ = second_child->bitsize_;
 			type_ = second_child->type_;
 		}
 
-		op_node(std::shared_ptr<abstract_node> child, uint32_t param, uint32_t additional_param):
-			op_kind_(OP_KIND::INDEX), first_child_(child), second_child_(nullptr),
+		op_node(const abstract_node* child, uint32_t param, uint32_t additional_param):
+			abstract_node(NODE_KIND::OPERATION_GADGET), op_kind_(OP_KIND::INDEX), first_child_(handle_of(child)),
 			param_(param), additional_param_(additional_param)
 		{
 			assert(type_ == NODE_TYPE::FIXED_WIDTH_INTEGER_NODE);
@@ -128,11 +271,13 @@ namespace gadgetlib
 			bitsize_ = additional_param - param + 1;
 		}
 
-		op_node(OP_KIND op_kind, std::shared_ptr<abstract_node> child,
-			uint32_t param) : op_kind_(op_kind), first_child_(child), 
-			second_child_(nullptr), param_(param)
+		op_node(OP_KIND op_kind, const abstract_node* child,
+			uint32_t param) : abstract_node(NODE_KIND::OPERATION_GADGET), op_kind_(op_kind),
+			first_child_(handle_of(child)), param_(param)
 		{
 			assert(type_ == NODE_TYPE::FIXED_WIDTH_INTEGER_NODE);
+			//EXTEND only widens
+			assert((op_kind != OP_KIND::EXTEND) || (param >= child->bitsize_));
 			if (op_kind == OP_KIND::TO_FIELD)
 				type_ = NODE_TYPE::FIELD_NODE;
 			else
@@ -144,97 +289,184 @@ namespace gadgetlib
 		{
 			if (op_kind_ == OP_KIND::ITE)
 				return 3;
-			return (second_child_ ? 2 : 1);
+			return (second_child_ != NULL_NODE ? 2 : 1);
 		}
 
 		abstract_node* get_child(uint32_t index) const
 		{
 			assert(index < 3);
-			if (index == 0)
-				return first_child_.get();
-			else if (index == 1)
-				return second_child_.get();
-			return third_child_.get();
+			node_handle handle = (index == 0 ? first_child_ :
+				(index == 1 ? second_child_ : third_child_));
+			return (handle != NULL_NODE ? arena_->get(handle) : nullptr);
 		}
 
 		OP_KIND kind() const { return op_kind_; }
 	};
 
-	class input_node : public abstract_node
+	//field element types (Field<T>, MontgomeryField<T>) are recognized by their byte encoding
+	template<typename T, typename = void>
+	struct is_field_element : std::false_type {};
+
+	template<typename T>
+	struct is_field_element<T, decltype((void)std::declval<const T&>().to_bytes())> :
+		std::true_type {};
+
+	/**
+	* Value of an input or a constant node, kept as a little-endian byte string. Textual
+	* values are parsed once, when the node is built; native field elements are copied
+	* from their byte encoding. The engraver turns it into a field element with a single
+	* FieldT::from_bytes call, and reads the bits of fixed-width values directly.
+	*/
+	class node_value
 	{
 	public:
-		bool is_public_input_;
-		boost::variant<uint32_t, std::string> witness_;
-	public:
-		input_node(uint32_t witness, uint32_t bitsize, bool is_public_input) :
-			abstract_node(bitsize), is_public_input_(is_public_input)
+		using bytes_type = boost::container::small_vector<uint8_t, 8>;
+
+		node_value(uint32_t value = 0);
+		//hex string, "d" and "b" prefixes stand for decimal and binary respectively
+		node_value(const std::string& str);
+		node_value(const uint8_t* data, size_t size) : bytes_(data, data + size) {}
+
+		template<typename FieldT,
+			typename = std::enable_if_t<is_field_element<FieldT>::value>>
+		explicit node_value(const FieldT& value)
 		{
-			witness_ = witness;
+			auto bytes = value.to_bytes();
+			bytes_.assign(bytes.begin(), bytes.end());
 		}
 
-		input_node(const std::string& witness, uint32_t bitsize, bool is_public_input) :
-			abstract_node(bitsize), is_public_input_(is_public_input)
+		bool get_bit(unsigned pos) const
 		{
-			witness_ = witness;
+			return (pos / 8 < bytes_.size()) && ((bytes_[pos / 8] >> (pos % 8)) & 1);
 		}
 
-		input_node(const std::string& witness, bool is_public_input) :
-			abstract_node(0, NODE_TYPE::FIELD_NODE), is_public_input_(is_public_input)
+		template<typename FieldT>
+		FieldT to_field() const
 		{
-			witness_ = witness;
+			return FieldT::from_bytes(bytes_.data(), bytes_.size());
 		}
+
+	private:
+		bytes_type bytes_;
+	};
+
+	class input_node : public abstract_node
+	{
+	public:
+		bool is_public_input_;
+		node_value witness_;
+	public:
+		input_node(const node_value& witness, uint32_t bitsize, bool is_public_input) :
+			abstract_node(NODE_KIND::INPUT_GADGET, bitsize), is_public_input_(is_public_input),
+			witness_(witness) {}
+
+		input_node(const node_value& witness, bool is_public_input) :
+			abstract_node(NODE_KIND::INPUT_GADGET, 0, NODE_TYPE::FIELD_NODE),
+			is_public_input_(is_public_input),
+			witness_(witness) {}
 	};
 
 	class const_node : public abstract_node
 	{
 	public:
-		boost::variant<uint32_t, std::string> value_;
+		node_value value_;
 	public:
-		const_node(uint32_t value, uint32_t bitlength) : abstract_node(bitlength)
-		{
-			value_ = value;
-		}
+		const_node(const node_value& value, uint32_t bitlength) :
+			abstract_node(NODE_KIND::CONSTANT_GADGET, bitlength), value_(value) {}
 
-		const_node(uint32_t value) : abstract_node(0, NODE_TYPE::FIELD_NODE)
-		{
-			value_ = value;
-		}
+		const_node(const node_value& value) :
+			abstract_node(NODE_KIND::CONSTANT_GADGET, 0, NODE_TYPE::FIELD_NODE), value_(value) {}
 	};
 
 	class gadget
 	{
 	public:
-		std::shared_ptr<abstract_node> node_;
+		//owned by the arena the gadget was built in
+		abstract_node* node_ = nullptr;
 		NODE_KIND kind_;
+		//generation of that arena at the time
+		uint64_t arena_generation_ = node_arena::current().generation();
+	private:
+		template<typename NodeT, typename... Args>
+		static abstract_node* make_node(Args&&... args)
+		{
+			return node_arena::current().make<NodeT>(std::forward<Args>(args)...);
+		}
+
+		template<typename... Args>
+		static abstract_node* make_op(Args&&... args)
+		{
+			op_node node(std::forward<Args>(args)...);
+			if (abstract_node* folded = fold(node))
+				return folded;
+			return node_arena::current().intern(node);
+		}
+
+		//fixed-width operations on constants are evaluated right away, as is ITE with a
+		//constant condition; returns the resulting node, or nullptr if node has to be built
+		static abstract_node* fold(const op_node& node);
+
+		//node of an operand, which has to be built in the current arena since it was last
+		//cleared: checked in release builds too, as a stale node_ may not be dereferenced
+		abstract_node* operand() const
+		{
+			if (!node_ || arena_generation_ != node_arena::current().generation())
+				throw std::runtime_error("gadget: operand is undefined or built in another, "
+					"cleared or freed node arena");
+			return node_;
+		}
 	public:
 		gadget(std::uint32_t value, std::uint32_t bitlength) :
-			node_(std::make_shared<const_node>(value, bitlength)),
+			node_(make_node<const_node>(value, bitlength)),
 			kind_(NODE_KIND::CONSTANT_GADGET) {}
 		gadget() : kind_(NODE_KIND::UNDEFINED) {}
 		gadget(OP_KIND op_kind, const gadget& first_child, const gadget& second_child) :
-			node_(std::make_shared<op_node>(op_kind, first_child.node_, second_child.node_)),
-			kind_(NODE_KIND::OPERATION_GADGET) {}
+			node_(make_op(op_kind, first_child.operand(), second_child.operand())),
+			kind_(node_->node_kind_) {}
 		gadget(OP_KIND op_kind, const gadget& child, uint32_t param = 0) :
-			node_(std::make_shared<op_node>(op_kind, child.node_, param)),
-			kind_(NODE_KIND::OPERATION_GADGET) {}
+			node_(make_op(op_kind, child.operand(), param)),
+			kind_(node_->node_kind_) {}
 		gadget(uint32_t witness, uint32_t bitsize, bool is_public_input) :
-			node_(std::make_shared<input_node>(witness, bitsize, is_public_input)),
+			node_(make_node<input_node>(witness, bitsize, is_public_input)),
 			kind_(NODE_KIND::INPUT_GADGET) {}
 		gadget(const std::string& arr, uint32_t bitsize, bool is_public_input = false):
-			node_(std::make_shared<input_node>(arr, bitsize, is_public_input)),
+			node_(make_node<input_node>(arr, bitsize, is_public_input)),
 			kind_(NODE_KIND::INPUT_GADGET) {}
 		gadget(const std::string& arr, bool is_public_input = false) :
-			node_(std::make_shared<input_node>(arr, is_public_input)),
+			node_(make_node<input_node>(arr, is_public_input)),
 			kind_(NODE_KIND::INPUT_GADGET) {}
 		gadget(const gadget& child, uint32_t lower_bound, uint32_t upper_bound) :
-			node_(std::make_shared<op_node>(child.node_, lower_bound, upper_bound)),
-			kind_(NODE_KIND::OPERATION_GADGET) {}
+			node_(make_op(child.operand(), lower_bound, upper_bound)),
+			kind_(node_->node_kind_) {}
 		gadget(const gadget& first_child, const gadget& second_child, 
 			const gadget& third_child) :
-			node_(std::make_shared<op_node>(first_child.node_, second_child.node_,
-				third_child.node_)),
-			kind_(NODE_KIND::OPERATION_GADGET) {}
-		gadget(uint32_t val) : node_(std::make_shared<const_node>(val)),
+			node_(make_op(first_child.operand(), second_child.operand(),
+				third_child.operand())),
+			kind_(node_->node_kind_) {}
+		gadget(uint32_t val) : node_(make_node<const_node>(val)),
+			kind_(NODE_KIND::CONSTANT_GADGET) {}
+
+		//fixed-width values given as little-endian bytes: an input if is_public_input is
+		//specified, a constant otherwise (same as for the uint32_t overloads)
+		gadget(const std::vector<uint8_t>& bytes, uint32_t bitsize, bool is_public_input) :
+			node_(make_node<input_node>(node_value(bytes.data(), bytes.size()),
+				bitsize, is_public_input)),
+			kind_(NODE_KIND::INPUT_GADGET) {}
+		gadget(const std::vector<uint8_t>& bytes, uint32_t bitlength) :
+			node_(make_node<const_node>(node_value(bytes.data(), bytes.size()),
+				bitlength)),
+			kind_(NODE_KIND::CONSTANT_GADGET) {}
+
+		//field elements taken directly from Field<T> / MontgomeryField<T> values
+		template<typename FieldT,
+			typename = std::enable_if_t<is_field_element<FieldT>::value>>
+		gadget(const FieldT& witness, bool is_public_input) :
+			node_(make_node<input_node>(node_value(witness), is_public_input)),
+			kind_(NODE_KIND::INPUT_GADGET) {}
+		template<typename FieldT,
+			typename = std::enable_if_t<is_field_element<FieldT>::value>>
+		explicit gadget(const FieldT& val) :
+			node_(make_node<const_node>(node_value(val))),
 			kind_(NODE_KIND::CONSTANT_GADGET) {}
 
 		uint32_t get_bitsize() const { return node_->bitsize_; } 
@@ -288,6 +520,9 @@ namespace gadgetlib
 	gadget TEMP_EQ(const gadget& a, const gadget& b);
 	gadget ALL(const std::vector<gadget>& gadget_vec);
 
+	//sum of all the elements; fixed-width sums are lowered as a single row
+	gadget SUM(const std::vector<gadget>& gadget_vec);
+
 	gadget TO_FIELD(const gadget& a);
 	gadget EXTEND(const gadget& a, unsigned bitsize);
 }
@@ -0,0 +1,58 @@
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace utils
+{
+	/**
+	* Thin cross-platform wrapper over a file used through memory mappings (mmap on POSIX,
+	* file mapping objects on Windows). Views are independent of each other and stay valid
+	* until unmapped, even when the file is grown afterwards. Failures of the underlying
+	* system calls are reported with std::runtime_error.
+	*/
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+		mapped_file(mapped_file&& other);
+		mapped_file& operator=(mapped_file&& other);
+		~mapped_file();
+
+		//anonymous scratch file in directory, removed from disk once closed
+		static mapped_file create_temporary(const std::string& directory);
+		//file at path, truncated if it exists
+		static mapped_file create(const std::string& path);
+		static mapped_file open_read_only(const std::string& path);
+
+		bool is_open() const;
+		bool is_writable() const { return writable_; }
+		uint64_t size() const { return size_; }
+		void resize(uint64_t size);
+		void close();
+
+		//offset must be a multiple of granularity()
+		void* map(uint64_t offset, size_t length);
+		static void unmap(void* addr, size_t length);
+		//writes dirty pages of the view back and drops them from memory; the view remains
+		//usable and is paged in from the file on next access
+		static void evict(void* addr, size_t length);
+		//alignment required for mapping offsets
+		static size_t granularity();
+
+	private:
+#if defined(_WIN32)
+		void* handle_ = nullptr;
+#else
+		int handle_ = -1;
+#endif
+		uint64_t size_ = 0;
+		bool writable_ = false;
+	};
+}
+
+#endif
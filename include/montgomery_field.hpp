@@ -0,0 +1,698 @@
+#ifndef MONTGOMERY_FIELD_HPP_
+#define MONTGOMERY_FIELD_HPP_
+
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+
+#include <boost/variant.hpp>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace gadgetlib
+{
+	namespace mont_detail
+	{
+		using limb_t = uint64_t;
+
+		//the widest modulus supported by MontgomeryField is 64 * MAX_LIMBS bits
+		static constexpr unsigned MAX_LIMBS = 8;
+
+		//returns the low part of a * b, the high part is stored in hi
+		inline limb_t mul_wide(limb_t a, limb_t b, limb_t& hi)
+		{
+#if defined(_MSC_VER)
+			return _umul128(a, b, &hi);
+#else
+			unsigned __int128 res = (unsigned __int128)a * b;
+			hi = (limb_t)(res >> 64);
+			return (limb_t)res;
+#endif
+		}
+
+		//returns a + b + carry, the outgoing carry is stored in carry
+		inline constexpr limb_t add_with_carry(limb_t a, limb_t b, limb_t& carry)
+		{
+			limb_t res = a + carry;
+			limb_t c = (res < carry);
+			res += b;
+			c += (res < b);
+			carry = c;
+			return res;
+		}
+
+		//returns a - b - borrow, the outgoing borrow is stored in borrow
+		inline constexpr limb_t sub_with_borrow(limb_t a, limb_t b, limb_t& borrow)
+		{
+			limb_t res = a - b;
+			limb_t br = (a < b);
+			limb_t res2 = res - borrow;
+			br += (res < borrow);
+			borrow = br;
+			return res2;
+		}
+
+		struct wide_number
+		{
+			limb_t limbs[MAX_LIMBS];
+		};
+
+		//compile-time parser for decimal characteristics strings
+		inline constexpr wide_number parse_decimal(const char* str)
+		{
+			wide_number result{};
+			for (; *str != 0; ++str)
+			{
+				//result = result * 10 + digit, done in 32-bit halves to stay constexpr
+				limb_t carry = (limb_t)(*str - '0');
+				for (unsigned i = 0; i < MAX_LIMBS; i++)
+				{
+					limb_t lo = (result.limbs[i] & 0xffffffff) * 10 + carry;
+					limb_t hi = (result.limbs[i] >> 32) * 10 + (lo >> 32);
+					result.limbs[i] = (lo & 0xffffffff) | (hi << 32);
+					carry = hi >> 32;
+				}
+			}
+			return result;
+		}
+
+		inline constexpr unsigned count_limbs(const wide_number& num)
+		{
+			unsigned count = MAX_LIMBS;
+			while (count > 0 && num.limbs[count - 1] == 0)
+				count--;
+			return count;
+		}
+
+		template<unsigned N>
+		struct montgomery_params
+		{
+			limb_t modulus[N];
+			//-modulus^(-1) mod 2^64
+			limb_t inv;
+			//R, R^2 and R^3 mod modulus, where R = 2^(64 * N)
+			limb_t r[N];
+			limb_t r2[N];
+			limb_t r3[N];
+		};
+
+		template<unsigned N>
+		inline constexpr bool geq(const limb_t* a, const limb_t* b)
+		{
+			for (unsigned i = N; i > 0; i--)
+			{
+				if (a[i - 1] != b[i - 1])
+					return a[i - 1] > b[i - 1];
+			}
+			return true;
+		}
+
+		template<unsigned N>
+		inline constexpr montgomery_params<N> compute_params(const char* characteristics)
+		{
+			montgomery_params<N> params{};
+			auto wide = parse_decimal(characteristics);
+			for (unsigned i = 0; i < N; i++)
+				params.modulus[i] = wide.limbs[i];
+
+			//Newton iteration: every step doubles the number of correct low bits
+			limb_t inv = params.modulus[0];
+			for (unsigned i = 0; i < 6; i++)
+				inv *= 2 - params.modulus[0] * inv;
+			params.inv = (limb_t)0 - inv;
+
+			//R^k mod p is obtained by doubling 1 modulo p (64 * N * k) times
+			limb_t acc[N] = {};
+			acc[0] = 1;
+			for (unsigned step = 1; step <= 3 * 64 * N; step++)
+			{
+				limb_t top = acc[N - 1] >> 63;
+				for (unsigned i = N - 1; i > 0; i--)
+					acc[i] = (acc[i] << 1) | (acc[i - 1] >> 63);
+				acc[0] <<= 1;
+				if (top || geq<N>(acc, params.modulus))
+				{
+					limb_t borrow = 0;
+					for (unsigned i = 0; i < N; i++)
+						acc[i] = sub_with_borrow(acc[i], params.modulus[i], borrow);
+				}
+				if (step == 64 * N)
+				{
+					for (unsigned i = 0; i < N; i++)
+						params.r[i] = acc[i];
+				}
+				if (step == 2 * 64 * N)
+				{
+					for (unsigned i = 0; i < N; i++)
+						params.r2[i] = acc[i];
+				}
+			}
+			for (unsigned i = 0; i < N; i++)
+				params.r3[i] = acc[i];
+			return params;
+		}
+
+		//in-place num = num * base + digit for arbitrary-length little-endian numbers
+		inline void mul_add_small(std::vector<limb_t>& num, limb_t base, limb_t digit)
+		{
+			limb_t carry = digit;
+			for (auto& limb : num)
+			{
+				limb_t hi;
+				limb_t lo = mul_wide(limb, base, hi);
+				lo += carry;
+				hi += (lo < carry);
+				limb = lo;
+				carry = hi;
+			}
+			if (carry)
+				num.push_back(carry);
+		}
+	}
+
+	/**
+	* Drop-in alternative for Field<T>: the residue is kept inline as a fixed number of
+	* 64-bit limbs (derived at compile time from T::characteristics) in Montgomery form,
+	* so field elements never touch the heap and arithmetic does not go through NTL.
+	*/
+	template<typename T>
+	class MontgomeryField
+	{
+	public:
+		using limb_t = mont_detail::limb_t;
+
+		static constexpr unsigned LIMBS =
+			mont_detail::count_limbs(mont_detail::parse_decimal(T::characteristics));
+		static_assert(LIMBS >= 2 && LIMBS <= mont_detail::MAX_LIMBS,
+			"characteristics is out of supported range");
+
+		using limbs_type = std::array<limb_t, LIMBS>;
+
+		static constexpr uint64_t safe_bitsize = T::safe_bitsize;
+
+	private:
+		static constexpr mont_detail::montgomery_params<LIMBS> params_ =
+			mont_detail::compute_params<LIMBS>(T::characteristics);
+
+		limbs_type limbs_ = {};
+
+		static void reduce_once(limbs_type& num, limb_t carry)
+		{
+			if (carry || mont_detail::geq<LIMBS>(num.data(), params_.modulus))
+			{
+				limb_t borrow = 0;
+				for (unsigned i = 0; i < LIMBS; i++)
+					num[i] = mont_detail::sub_with_borrow(num[i], params_.modulus[i], borrow);
+			}
+		}
+
+		//CIOS Montgomery multiplication: returns a * b / R mod p
+		static limbs_type mont_mul(const limb_t* a, const limb_t* b)
+		{
+			limb_t t[LIMBS + 2] = {};
+			for (unsigned i = 0; i < LIMBS; i++)
+			{
+				limb_t carry = 0;
+				for (unsigned j = 0; j < LIMBS; j++)
+				{
+					limb_t hi;
+					limb_t lo = mont_detail::mul_wide(a[j], b[i], hi);
+					lo += t[j];
+					hi += (lo < t[j]);
+					lo += carry;
+					hi += (lo < carry);
+					t[j] = lo;
+					carry = hi;
+				}
+				limb_t top_carry = 0;
+				t[LIMBS] = mont_detail::add_with_carry(t[LIMBS], carry, top_carry);
+				t[LIMBS + 1] = top_carry;
+
+				limb_t m = t[0] * params_.inv;
+				limb_t hi;
+				limb_t lo = mont_detail::mul_wide(m, params_.modulus[0], hi);
+				lo += t[0];
+				hi += (lo < t[0]);
+				carry = hi;
+				for (unsigned j = 1; j < LIMBS; j++)
+				{
+					lo = mont_detail::mul_wide(m, params_.modulus[j], hi);
+					lo += t[j];
+					hi += (lo < t[j]);
+					lo += carry;
+					hi += (lo < carry);
+					t[j - 1] = lo;
+					carry = hi;
+				}
+				top_carry = 0;
+				t[LIMBS - 1] = mont_detail::add_with_carry(t[LIMBS], carry, top_carry);
+				t[LIMBS] = t[LIMBS + 1] + top_carry;
+			}
+
+			limbs_type result;
+			for (unsigned i = 0; i < LIMBS; i++)
+				result[i] = t[i];
+			reduce_once(result, t[LIMBS]);
+			return result;
+		}
+
+		static limbs_type to_montgomery(const limbs_type& plain)
+		{
+			return mont_mul(plain.data(), params_.r2);
+		}
+
+		limbs_type to_plain() const
+		{
+			limbs_type one = {};
+			one[0] = 1;
+			return mont_mul(limbs_.data(), one.data());
+		}
+
+		static bool is_zero(const limbs_type& num)
+		{
+			for (auto limb : num)
+			{
+				if (limb != 0)
+					return false;
+			}
+			return true;
+		}
+
+		static void halve_mod(limbs_type& num)
+		{
+			//num is kept in [0, p): for odd num we halve num + p instead
+			limb_t carry = 0;
+			if (num[0] & 1)
+			{
+				for (unsigned i = 0; i < LIMBS; i++)
+					num[i] = mont_detail::add_with_carry(num[i], params_.modulus[i], carry);
+			}
+			for (unsigned i = 0; i + 1 < LIMBS; i++)
+				num[i] = (num[i] >> 1) | (num[i + 1] << 63);
+			num[LIMBS - 1] = (num[LIMBS - 1] >> 1) | (carry << 63);
+		}
+
+		static void sub_mod(limbs_type& a, const limbs_type& b)
+		{
+			limb_t borrow = 0;
+			for (unsigned i = 0; i < LIMBS; i++)
+				a[i] = mont_detail::sub_with_borrow(a[i], b[i], borrow);
+			if (borrow)
+			{
+				limb_t carry = 0;
+				for (unsigned i = 0; i < LIMBS; i++)
+					a[i] = mont_detail::add_with_carry(a[i], params_.modulus[i], carry);
+			}
+		}
+
+		void assign_wide(const std::vector<limb_t>& wide)
+		{
+			//Horner scheme over 64-bit digits, carried out in Montgomery form
+			limbs_type shift = {};
+			shift[1] = 1;
+			shift = to_montgomery(shift);
+			limbs_ = {};
+			for (auto it = wide.rbegin(); it != wide.rend(); ++it)
+			{
+				limbs_type digit = {};
+				digit[0] = *it;
+				limbs_ = mont_mul(limbs_.data(), shift.data());
+				*this += MontgomeryField(to_montgomery(digit));
+			}
+		}
+
+		void assign_string(const std::string& hexVal)
+		{
+			bool decimal = (hexVal[0] == 'd');
+			bool binary = (hexVal[0] == 'b');
+
+			auto convert_ch = [](char c) -> limb_t
+			{
+				if (c >= '0' && c <= '9')
+					return (c - '0');
+				if (c >= 'a' && c <= 'f')
+					return (c - 'a' + 10);
+				return 0;
+			};
+
+			limb_t base = (decimal ? 10 : (binary ? 2 : 0x10));
+			std::vector<limb_t> wide;
+			for (size_t i = ((decimal || binary) ? 1 : 0); i < hexVal.length(); i++)
+				mont_detail::mul_add_small(wide, base, convert_ch(hexVal[i]));
+			assign_wide(wide);
+		}
+
+		explicit MontgomeryField(const limbs_type& mont_limbs) : limbs_(mont_limbs) {}
+
+	public:
+		/**
+		* Accumulates products as unreduced 2 * LIMBS-limb numbers, so that a sum of
+		* products costs a single Montgomery reduction instead of one per term.
+		*/
+		class accumulator
+		{
+		private:
+			limb_t t_[2 * LIMBS] = {};
+
+			void add_at(unsigned pos, limb_t carry)
+			{
+				for (; carry && pos < 2 * LIMBS; pos++)
+					t_[pos] = mont_detail::add_with_carry(t_[pos], 0, carry);
+				//the sum has wrapped past 2^(128 * LIMBS) = R^2, which is R^2 mod p modulo p
+				while (carry)
+				{
+					carry = 0;
+					for (unsigned i = 0; i < LIMBS; i++)
+						t_[i] = mont_detail::add_with_carry(t_[i], params_.r2[i], carry);
+					for (unsigned i = LIMBS; carry && i < 2 * LIMBS; i++)
+						t_[i] = mont_detail::add_with_carry(t_[i], 0, carry);
+				}
+			}
+
+		public:
+			void mul_add(const MontgomeryField& a, const MontgomeryField& b)
+			{
+				for (unsigned i = 0; i < LIMBS; i++)
+				{
+					limb_t carry = 0;
+					for (unsigned j = 0; j < LIMBS; j++)
+					{
+						limb_t hi;
+						limb_t lo = mont_detail::mul_wide(a.limbs_[j], b.limbs_[i], hi);
+						lo += t_[i + j];
+						hi += (lo < t_[i + j]);
+						lo += carry;
+						hi += (lo < carry);
+						t_[i + j] = lo;
+						carry = hi;
+					}
+					add_at(i + LIMBS, carry);
+				}
+			}
+
+			MontgomeryField reduce() const
+			{
+				//T / R = T_hi + T_lo / R for T = T_hi * R + T_lo
+				limbs_type plain_one = {};
+				plain_one[0] = 1;
+				MontgomeryField result(mont_mul(t_ + LIMBS, params_.r));
+				result += MontgomeryField(mont_mul(t_, plain_one.data()));
+				return result;
+			}
+		};
+
+		MontgomeryField() = default;
+
+		MontgomeryField(size_t num)
+		{
+			limbs_type plain = {};
+			plain[0] = num;
+			limbs_ = to_montgomery(plain);
+		}
+
+		MontgomeryField(const boost::variant<uint32_t, std::string>& v)
+		{
+			switch (v.which())
+			{
+			case 0:
+				*this = MontgomeryField((size_t)boost::get<uint32_t>(v));
+				break;
+			case 1:
+				assign_string(boost::get<std::string>(v));
+				break;
+			};
+		}
+
+		MontgomeryField(bool flag, bool q) : MontgomeryField((size_t)(flag ? 1 : 0)) {}
+
+		MontgomeryField& operator+=(const MontgomeryField& rhs)
+		{
+			limb_t carry = 0;
+			for (unsigned i = 0; i < LIMBS; i++)
+				limbs_[i] = mont_detail::add_with_carry(limbs_[i], rhs.limbs_[i], carry);
+			reduce_once(limbs_, carry);
+			return *this;
+		}
+
+		MontgomeryField& operator-=(const MontgomeryField& rhs)
+		{
+			sub_mod(limbs_, rhs.limbs_);
+			return *this;
+		}
+
+		MontgomeryField& operator*=(const MontgomeryField& rhs)
+		{
+			limbs_ = mont_mul(limbs_.data(), rhs.limbs_.data());
+			return *this;
+		}
+
+		MontgomeryField operator-() const
+		{
+			MontgomeryField result;
+			sub_mod(result.limbs_, limbs_);
+			return result;
+		}
+
+		static MontgomeryField one()
+		{
+			return 1;
+		}
+
+		static MontgomeryField zero()
+		{
+			return 0;
+		}
+
+		//raw access to the Montgomery representation, used by the batch kernels
+		//in field_kernels.hpp that keep elements in structure-of-arrays layout
+		const limbs_type& montgomery_limbs() const
+		{
+			return limbs_;
+		}
+
+		static MontgomeryField from_montgomery_limbs(const limbs_type& limbs)
+		{
+			return MontgomeryField(limbs);
+		}
+
+		static constexpr const mont_detail::montgomery_params<LIMBS>& parameters()
+		{
+			return params_;
+		}
+
+		operator bool() const
+		{
+			return !is_zero(limbs_);
+		}
+
+		bool operator==(const MontgomeryField& other) const
+		{
+			return limbs_ == other.limbs_;
+		}
+
+		bool operator!=(const MontgomeryField& other) const
+		{
+			return limbs_ != other.limbs_;
+		}
+
+		//hash consistent with ==, mixed from the (canonical) Montgomery limbs
+		uint64_t hash() const
+		{
+			uint64_t result = 0;
+			for (limb_t limb : limbs_)
+				result = (result ^ limb) * 0x100000001b3ULL;
+			return result;
+		}
+
+		std::string to_string() const
+		{
+			//repeated division by 10^9, carried out in 32-bit halves
+			static constexpr limb_t CHUNK = 1000000000;
+			auto plain = to_plain();
+			std::string result;
+			while (!is_zero(plain))
+			{
+				limb_t rem = 0;
+				for (unsigned i = LIMBS; i > 0; i--)
+				{
+					limb_t hi = (rem << 32) | (plain[i - 1] >> 32);
+					rem = hi % CHUNK;
+					limb_t lo = (rem << 32) | (plain[i - 1] & 0xffffffff);
+					rem = lo % CHUNK;
+					plain[i - 1] = ((hi / CHUNK) << 32) | (lo / CHUNK);
+				}
+				for (unsigned i = 0; i < 9; i++)
+				{
+					result.push_back((char)('0' + rem % 10));
+					rem /= 10;
+				}
+			}
+			while (result.size() > 1 && result.back() == '0')
+				result.pop_back();
+			if (result.empty())
+				result = "0";
+			std::reverse(result.begin(), result.end());
+			return result;
+		}
+
+		//number of bytes in the canonical encoding, i.e. the byte length of the modulus
+		static size_t byte_size()
+		{
+			size_t size = 8 * (LIMBS - 1);
+			for (limb_t top = params_.modulus[LIMBS - 1]; top != 0; top >>= 8)
+				size++;
+			return size;
+		}
+
+		//little-endian canonical representative, padded to byte_size()
+		std::vector<uint8_t> to_bytes() const
+		{
+			auto plain = to_plain();
+			std::vector<uint8_t> result(byte_size());
+			for (size_t i = 0; i < result.size(); i++)
+				result[i] = (uint8_t)(plain[i / 8] >> (8 * (i % 8)));
+			return result;
+		}
+
+		//little-endian number of any length, reduced modulo the characteristics
+		static MontgomeryField from_bytes(const uint8_t* data, size_t size)
+		{
+			std::vector<limb_t> wide((size + 7) / 8, 0);
+			for (size_t i = 0; i < size; i++)
+				wide[i / 8] |= (limb_t)data[i] << (8 * (i % 8));
+			while (!wide.empty() && wide.back() == 0)
+				wide.pop_back();
+
+			MontgomeryField result;
+			if (wide.size() < LIMBS || (wide.size() == LIMBS &&
+				!mont_detail::geq<LIMBS>(wide.data(), params_.modulus)))
+			{
+				limbs_type plain = {};
+				std::copy(wide.begin(), wide.end(), plain.begin());
+				result.limbs_ = to_montgomery(plain);
+			}
+			else
+				result.assign_wide(wide);
+			return result;
+		}
+
+		MontgomeryField inverse() const
+		{
+			assert(!is_zero(limbs_) && "zero is not invertible");
+			//binary extended Euclid on aR: yields (aR)^(-1), which is then scaled by R^3
+			limbs_type u = limbs_, v = {}, x1 = {}, x2 = {}, one = {};
+			for (unsigned i = 0; i < LIMBS; i++)
+				v[i] = params_.modulus[i];
+			x1[0] = 1;
+			one[0] = 1;
+
+			auto shift_right = [](limbs_type& num)
+			{
+				for (unsigned i = 0; i + 1 < LIMBS; i++)
+					num[i] = (num[i] >> 1) | (num[i + 1] << 63);
+				num[LIMBS - 1] >>= 1;
+			};
+			auto geq = [](const limbs_type& a, const limbs_type& b)
+			{
+				return mont_detail::geq<LIMBS>(a.data(), b.data());
+			};
+
+			while (u != one && v != one && !is_zero(u) && !is_zero(v))
+			{
+				while ((u[0] & 1) == 0)
+				{
+					shift_right(u);
+					halve_mod(x1);
+				}
+				while ((v[0] & 1) == 0)
+				{
+					shift_right(v);
+					halve_mod(x2);
+				}
+				if (geq(u, v))
+				{
+					limb_t borrow = 0;
+					for (unsigned i = 0; i < LIMBS; i++)
+						u[i] = mont_detail::sub_with_borrow(u[i], v[i], borrow);
+					sub_mod(x1, x2);
+				}
+				else
+				{
+					limb_t borrow = 0;
+					for (unsigned i = 0; i < LIMBS; i++)
+						v[i] = mont_detail::sub_with_borrow(v[i], u[i], borrow);
+					sub_mod(x2, x1);
+				}
+			}
+			const limbs_type& inv = (u == one ? x1 : x2);
+			return MontgomeryField(mont_mul(inv.data(), params_.r3));
+		}
+
+		MontgomeryField get_bit_at_pos(unsigned index) const
+		{
+			if (index >= 64 * LIMBS)
+				return MontgomeryField::zero();
+			auto plain = to_plain();
+			return ((plain[index / 64] >> (index % 64)) & 1) ? MontgomeryField::one() :
+				MontgomeryField::zero();
+		}
+
+		//writes bits first_bit, ..., first_bit + count - 1 of the value to bits[0..count)
+		void get_bits(MontgomeryField* bits, size_t count, size_t first_bit = 0) const
+		{
+			auto plain = to_plain();
+			for (size_t i = 0; i < count; i++)
+			{
+				size_t pos = first_bit + i;
+				bool bit = (pos < 64 * LIMBS) && ((plain[pos / 64] >> (pos % 64)) & 1);
+				bits[i] = (bit ? MontgomeryField::one() : MontgomeryField::zero());
+			}
+		}
+	};
+
+	template<typename T>
+	constexpr mont_detail::montgomery_params<MontgomeryField<T>::LIMBS> MontgomeryField<T>::params_;
+
+	template<typename T>
+	MontgomeryField<T> operator+(const MontgomeryField<T>& left,
+		const MontgomeryField<T>& right)
+	{
+		MontgomeryField<T> result = left;
+		result += right;
+		return result;
+	}
+
+	template<typename T>
+	MontgomeryField<T> operator-(const MontgomeryField<T>& left,
+		const MontgomeryField<T>& right)
+	{
+		MontgomeryField<T> result = left;
+		result -= right;
+		return result;
+	}
+
+	template<typename T>
+	MontgomeryField<T> operator*(const MontgomeryField<T>& left,
+		const MontgomeryField<T>& right)
+	{
+		MontgomeryField<T> result = left;
+		result *= right;
+		return result;
+	}
+
+	template<typename T>
+	std::ostream& operator<< (std::ostream& stream, const MontgomeryField<T>& elem)
+	{
+		stream << elem.to_string();
+		return stream;
+	}
+}
+
+#endif
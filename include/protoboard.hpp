@@ -1,8 +1,22 @@
 #ifndef PROTOBOARD_HPP_
 #define PROTOBOARD_HPP_
 
+#include <stdint.h>
+
 #include <vector>
-#include <set>
+#include <deque>
+#include <algorithm>
+#include <limits>
+#include <iterator>
+#include <cassert>
+#include <thread>
+#include <unordered_map>
+#include <map>
+
+#include <boost/container/small_vector.hpp>
+#include <boost/icl/interval_set.hpp>
+
+#include "chunked_assignment.hpp"
 
 //TODO: delete it later
 #include <iostream>
@@ -10,7 +24,12 @@
 namespace gadgetlib
 {	
 	using var_index_t = size_t;
-	using variable_set = std::set<var_index_t>;
+	//sets of wires are stored as disjoint intervals of indices, so a range of consecutive
+	//wires (e.g. the bits of a public hash) takes a single node
+	using variable_set = boost::icl::interval_set<var_index_t>;
+	using variable_interval = boost::icl::interval<var_index_t>;
+	//wires of the bits of a value, least significant first; not necessarily consecutive
+	using variable_list = std::vector<var_index_t>;
 	using integer_coeff_t = size_t;
 
 	template<typename FieldT>
@@ -22,6 +41,9 @@ namespace gadgetlib
 	template<typename FieldT>
 	struct pb_linear_combination;
 
+	template<typename FieldT>
+	class r1cs_constraint_system;
+
 	//TODO: use BOOST operators for overloading
 
 	template<typename FieldT>
@@ -113,14 +135,22 @@ namespace gadgetlib
 
 	/**
 	* A linear combination represents a formal expression of the form "sum_i coeff_i * x_{index_i}".
+	* Terms are kept sorted by variable index with no index repeated, and terms whose coefficients
+	* cancel out while merging are dropped; almost all combinations built by the engraver have
+	* at most three terms, and those are stored inline.
 	*/
 	template<typename FieldT>
 	struct pb_linear_combination
 	{
 	public:
+		static constexpr unsigned INLINE_TERMS = 3;
+		using terms_type = boost::container::small_vector<pb_linear_term<FieldT>, INLINE_TERMS>;
 
-		std::vector<pb_linear_term<FieldT>> terms;
+	private:
+		friend class r1cs_constraint_system<FieldT>;
+		terms_type terms;
 
+	public:
 		pb_linear_combination() {};
 		pb_linear_combination(const integer_coeff_t int_coeff);
 		//pb_linear_combination(int int_coeff);
@@ -130,8 +160,10 @@ namespace gadgetlib
 		pb_linear_combination(const std::vector<pb_linear_term<FieldT> > &all_terms);
 
 		/* for supporting range-based for loops over linear_combination */
-		typename std::vector<pb_linear_term<FieldT> >::const_iterator begin() const;
-		typename std::vector<pb_linear_term<FieldT> >::const_iterator end() const;
+		typename terms_type::const_iterator begin() const;
+		typename terms_type::const_iterator end() const;
+		size_t size() const { return terms.size(); }
+		bool empty() const { return terms.empty(); }
 
 		void add_term(const pb_variable<FieldT> &var);
 		void add_term(const pb_variable<FieldT> &var, const integer_coeff_t int_coeff);
@@ -139,6 +171,15 @@ namespace gadgetlib
 
 		void add_term(const pb_linear_term<FieldT> &lt);
 
+		void reserve(size_t num_terms);
+
+		//in-place addition: a term (or a combination) whose indices all follow the current
+		//ones is appended in amortized O(1) per term, anything else is merged in linear time
+		pb_linear_combination<FieldT>& operator+=(const pb_linear_term<FieldT> &lt);
+		pb_linear_combination<FieldT>& operator+=(const pb_linear_combination<FieldT> &other);
+		pb_linear_combination<FieldT>& operator+=(pb_linear_combination<FieldT> &&other);
+		pb_linear_combination<FieldT>& operator-=(const pb_linear_combination<FieldT> &other);
+
 		FieldT evaluate(const std::vector<FieldT> &assignment) const;
 
 		pb_linear_combination<FieldT> operator*(const integer_coeff_t int_coeff) const;
@@ -148,6 +189,22 @@ namespace gadgetlib
 		pb_linear_combination<FieldT> operator-(const pb_linear_combination<FieldT> &other) const;
 		pb_linear_combination<FieldT> operator-() const;
 
+		//a temporary on the left is extended in place, so chains like a + b - c build
+		//a single term vector
+		friend pb_linear_combination<FieldT> operator+(pb_linear_combination<FieldT> &&lhs,
+			const pb_linear_combination<FieldT> &rhs)
+		{
+			lhs += rhs;
+			return std::move(lhs);
+		}
+
+		friend pb_linear_combination<FieldT> operator-(pb_linear_combination<FieldT> &&lhs,
+			const pb_linear_combination<FieldT> &rhs)
+		{
+			lhs -= rhs;
+			return std::move(lhs);
+		}
+
 		bool operator==(const pb_linear_combination<FieldT> &other) const;
 
 		//TODO: delete it later
@@ -187,13 +244,28 @@ namespace gadgetlib
 	template<typename FieldT>
 	pb_linear_combination<FieldT> operator-(const FieldT &field_coeff, const pb_linear_combination<FieldT> &lc);
 
+	/**
+	* Inner product kernel: computes sum_i coeff_i * value_at(index_i) over a span of linear
+	* terms. Products are accumulated unreduced (see FieldT::accumulator) and the sum is
+	* reduced once, so this is the routine to use for any matrix-vector style evaluation.
+	*/
+	template<typename FieldT, typename TermIterator, typename ValueAccessor>
+	FieldT inner_product(TermIterator first, TermIterator last, ValueAccessor&& value_at);
+
+	template<typename FieldT, typename TermIterator>
+	FieldT inner_product(TermIterator first, TermIterator last, 
+		const std::vector<FieldT>& assignment);
+
+	template<typename FieldT, typename TermIterator>
+	FieldT inner_product(TermIterator first, TermIterator last,
+		const chunked_assignment<FieldT>& assignment);
+
 	template<typename FieldT>
-	using r1cs_variable_assignment = std::vector<FieldT>;
-	//TODO: use boost intervals instead of simple sets
+	using r1cs_variable_assignment = chunked_assignment<FieldT>;
 	template<typename FieldT>
-	using r1cs_primary_input = std::set<var_index_t>;
+	using r1cs_primary_input = variable_set;
 	template<typename FieldT>
-	using r1cs_auxiliary_input = std::set<var_index_t>;
+	using r1cs_auxiliary_input = variable_set;
 
 	template<typename FieldT>
 	struct r1cs_constraint
@@ -205,8 +277,179 @@ namespace gadgetlib
 			const pb_linear_combination<FieldT>& c) : a_(a), b_(b), c_(c) {}
 	};
 
+	/**
+	* Term of a stored constraint: same as pb_linear_term, but with a 32-bit variable index.
+	*/
 	template<typename FieldT>
-	using r1cs_constraint_system = std::vector<r1cs_constraint<FieldT>>;
+	struct r1cs_term
+	{
+		uint32_t index;
+		FieldT coeff;
+
+		r1cs_term(uint32_t index, FieldT coeff) : index(index), coeff(std::move(coeff)) {}
+	};
+
+	/**
+	* Read-only view of one linear combination of a stored constraint.
+	*/
+	template<typename FieldT>
+	class r1cs_linear_combination_view
+	{
+	private:
+		const r1cs_term<FieldT>* first_;
+		const r1cs_term<FieldT>* last_;
+	public:
+		r1cs_linear_combination_view(const r1cs_term<FieldT>* first,
+			const r1cs_term<FieldT>* last) : first_(first), last_(last) {}
+
+		const r1cs_term<FieldT>* begin() const { return first_; }
+		const r1cs_term<FieldT>* end() const { return last_; }
+		size_t size() const { return last_ - first_; }
+		bool empty() const { return first_ == last_; }
+
+		//TODO: delete it later
+		void dump() const
+		{
+			bool first = true;
+			for (auto& term : *this)
+			{
+				if (!first)
+					std::cout << " + ";
+				if (term.index > 0)
+					std::cout << "(" << (term.coeff) << " * var_" << term.index << ") ";
+				else
+					std::cout << "(" << (term.coeff) << ") ";
+				first = false;
+			}
+			std::cout << std::endl;
+		}
+	};
+
+	/**
+	* Read-only view of a stored constraint <a,x> * <b,x> = <c,x>.
+	*/
+	template<typename FieldT>
+	struct r1cs_constraint_view
+	{
+		r1cs_linear_combination_view<FieldT> a_, b_, c_;
+	};
+
+	/**
+	* Constraint system in compressed sparse row form: the terms of all linear combinations
+	* are kept in one contiguous array, and row i owns the terms between offsets
+	* 3i, 3i + 1, 3i + 2 and 3i + 3 (for a, b and c respectively). Compared to a vector of
+	* r1cs_constraint this saves three allocations per constraint, and a scan over the rows
+	* walks memory sequentially.
+	*/
+	template<typename FieldT>
+	class r1cs_constraint_system
+	{
+	private:
+		std::vector<r1cs_term<FieldT>> terms_;
+		std::vector<size_t> offsets_ = { 0 };
+
+		void append_terms(const pb_linear_combination<FieldT>& lc)
+		{
+			for (auto& term : lc)
+			{
+				assert(term.index <= std::numeric_limits<uint32_t>::max());
+				terms_.emplace_back((uint32_t)term.index, term.coeff);
+			}
+			offsets_.push_back(terms_.size());
+		}
+
+		void append_terms(pb_linear_combination<FieldT>&& lc)
+		{
+			for (auto& term : lc.terms)
+			{
+				assert(term.index <= std::numeric_limits<uint32_t>::max());
+				terms_.emplace_back((uint32_t)term.index, std::move(term.coeff));
+			}
+			offsets_.push_back(terms_.size());
+		}
+
+		r1cs_linear_combination_view<FieldT> view(size_t pos) const
+		{
+			const r1cs_term<FieldT>* base = terms_.data();
+			return r1cs_linear_combination_view<FieldT>(base + offsets_[pos],
+				base + offsets_[pos + 1]);
+		}
+
+	public:
+		class const_iterator
+		{
+		private:
+			const r1cs_constraint_system* system_;
+			size_t row_;
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = r1cs_constraint_view<FieldT>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = r1cs_constraint_view<FieldT>;
+
+			const_iterator(const r1cs_constraint_system* system, size_t row) :
+				system_(system), row_(row) {}
+
+			reference operator*() const { return (*system_)[row_]; }
+			const_iterator& operator++() { ++row_; return *this; }
+			const_iterator operator++(int) { const_iterator temp = *this; ++row_; return temp; }
+			bool operator==(const const_iterator& other) const { return row_ == other.row_; }
+			bool operator!=(const const_iterator& other) const { return row_ != other.row_; }
+		};
+
+		void add_constraint(const pb_linear_combination<FieldT>& a,
+			const pb_linear_combination<FieldT>& b, const pb_linear_combination<FieldT>& c)
+		{
+			append_terms(a);
+			append_terms(b);
+			append_terms(c);
+		}
+
+		void add_constraint(pb_linear_combination<FieldT>&& a, pb_linear_combination<FieldT>&& b,
+			pb_linear_combination<FieldT>&& c)
+		{
+			append_terms(std::move(a));
+			append_terms(std::move(b));
+			append_terms(std::move(c));
+		}
+
+		void add_constraint(const r1cs_constraint<FieldT>& constr)
+		{
+			add_constraint(constr.a_, constr.b_, constr.c_);
+		}
+
+		size_t size() const { return (offsets_.size() - 1) / 3; }
+		bool empty() const { return size() == 0; }
+		size_t num_terms() const { return terms_.size(); }
+
+		void reserve(size_t num_constraints, size_t num_terms)
+		{
+			offsets_.reserve(3 * num_constraints + 1);
+			terms_.reserve(num_terms);
+		}
+
+		r1cs_constraint_view<FieldT> operator[](size_t row) const
+		{
+			return { view(3 * row), view(3 * row + 1), view(3 * row + 2) };
+		}
+
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, size()); }
+	};
+
+	/**
+	* Receiver of the constraints a protoboard generates, in generation order. Implementations
+	* are in constraint_sinks.hpp.
+	*/
+	template<typename FieldT>
+	class r1cs_constraint_sink
+	{
+	public:
+		virtual ~r1cs_constraint_sink() = default;
+		virtual void add_constraint(pb_linear_combination<FieldT>&& a,
+			pb_linear_combination<FieldT>&& b, pb_linear_combination<FieldT>&& c) = 0;
+	};
 	
 	template<typename FieldT>
 	class protoboard
@@ -214,27 +457,254 @@ namespace gadgetlib
 	public:
 		var_index_t next_free_var_ = 1;	
 
+		//holds the constraints unless they are redirected with set_constraint_sink
 		r1cs_constraint_system<FieldT> constraints_;
-		//TODO: may be it is better to represent via intervals (BOOST INTERVALS?)
 		variable_set public_wires;
-		//TODO: assignment will be a very huge vector - how to make it smaller
+		//wires removed from the constraints by protoboard_passes.hpp
+		variable_set eliminated_wires;
+		//chunked, so it grows without copying; see chunked_assignment::enable_spill for
+		//circuits whose witness does not fit in memory
 		r1cs_variable_assignment<FieldT> assignment;
 
+	private:
+		//deque keeps references returned by power_of_two valid while the table grows
+		std::deque<FieldT> powers_of_two_;
+		r1cs_constraint_sink<FieldT>* sink_ = nullptr;
+		size_t num_constraints_ = 0;
+		var_index_t zero_var_ = 0;
+
+		bool deduplicate_ = false;
+		size_t num_duplicates_ = 0;
+		size_t num_cache_hits_ = 0;
+		//hash of the normalised (a, b, c) triple -> row of constraints_
+		std::unordered_multimap<uint64_t, size_t> row_hashes_;
+		//bits -> packed variable and (packed variable, bitsize) -> bits, so repeated
+		//packing and unpacking of the same wires reuse the first result
+		std::map<variable_list, var_index_t> packed_cache_;
+		std::map<std::pair<var_index_t, uint32_t>, std::pair<var_index_t, var_index_t>> unpacked_cache_;
+
+		static uint64_t mix_hash(uint64_t seed, uint64_t val)
+		{
+			seed ^= val + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+			return seed;
+		}
+
+		static uint64_t hash_lc(const pb_linear_combination<FieldT>& lc)
+		{
+			uint64_t result = lc.size();
+			for (const auto& term : lc)
+			{
+				result = mix_hash(result, term.index);
+				result = mix_hash(result, term.coeff.hash());
+			}
+			return result;
+		}
+
+		static bool same_lc(const pb_linear_combination<FieldT>& lhs,
+			const r1cs_linear_combination_view<FieldT>& rhs)
+		{
+			return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin(),
+				[](const pb_linear_term<FieldT>& x, const r1cs_term<FieldT>& y)
+				{
+					return x.index == y.index && x.coeff == y.coeff;
+				});
+		}
+
+		//normalises the constraint (a and b ordered by hash), returns false if an identical
+		//row is stored already and records the new row's hash otherwise
+		bool register_constraint(pb_linear_combination<FieldT>& a, pb_linear_combination<FieldT>& b,
+			const pb_linear_combination<FieldT>& c)
+		{
+			uint64_t hash_a = hash_lc(a);
+			uint64_t hash_b = hash_lc(b);
+			if (hash_b < hash_a)
+			{
+				std::swap(a, b);
+				std::swap(hash_a, hash_b);
+			}
+			uint64_t hash = mix_hash(mix_hash(hash_a, hash_b), hash_lc(c));
+
+			auto range = row_hashes_.equal_range(hash);
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				auto row = constraints_[it->second];
+				if (same_lc(a, row.a_) && same_lc(b, row.b_) && same_lc(c, row.c_))
+				{
+					num_duplicates_++;
+					return false;
+				}
+			}
+			row_hashes_.emplace(hash, constraints_.size());
+			return true;
+		}
+
 	public:
 		protoboard()
 		{
 			assignment.emplace_back(1);
 		};	
 
+		//2^i, computed once per protoboard and shared by all packing equations
+		const FieldT& power_of_two(unsigned i)
+		{
+			if (powers_of_two_.empty())
+				powers_of_two_.emplace_back(1);
+			while (powers_of_two_.size() <= i)
+			{
+				FieldT next = powers_of_two_.back();
+				next *= 2;
+				powers_of_two_.push_back(next);
+			}
+			return powers_of_two_[i];
+		}
+
+		/**
+		* Sends all constraints generated from now on to sink instead of constraints_; nullptr
+		* switches back. The sink is not owned and has to outlive the protoboard's use.
+		*/
+		void set_constraint_sink(r1cs_constraint_sink<FieldT>* sink)
+		{
+			sink_ = sink;
+		}
+
+		//number of constraints generated so far, wherever they went
+		size_t num_constraints() const
+		{
+			return num_constraints_;
+		}
+
+		//swaps in a rewritten constraint system, for the passes in protoboard_passes.hpp
+		void replace_constraints(r1cs_constraint_system<FieldT>&& system)
+		{
+			constraints_ = std::move(system);
+			num_constraints_ = constraints_.size();
+			row_hashes_.clear();
+		}
+
+		/**
+		* Records that a pass removed var from every constraint. If var is the zero wire, the
+		* next zero_var() call allocates a fresh one; the caches of enable_deduplication start
+		* over, as they may hand out var or wires defined through it.
+		*/
+		void eliminate_wire(var_index_t var)
+		{
+			eliminated_wires.insert(var);
+			if (var == zero_var_)
+				zero_var_ = 0;
+			packed_cache_.clear();
+			unpacked_cache_.clear();
+		}
+
+		/**
+		* Moves every wire var to new_index[var], which must be a bijection of the kept wires
+		* onto [0, num_variables) fixing the constant one; new_index[var] == 0 drops a wire,
+		* which must not occur in any constraint. Constraints, public wires and the assignment
+		* are remapped together; eliminated wires are gone afterwards, and the caches of
+		* enable_deduplication start over.
+		*/
+		void remap_variables(const std::vector<var_index_t>& new_index, var_index_t num_variables)
+		{
+			assert(new_index.size() == next_free_var_ && new_index[0] == 0);
+
+			r1cs_constraint_system<FieldT> remapped;
+			remapped.reserve(constraints_.size(), constraints_.num_terms());
+			std::vector<pb_linear_term<FieldT>> terms;
+			auto remap = [&](const r1cs_linear_combination_view<FieldT>& lc)
+			{
+				terms.clear();
+				for (const auto& term : lc)
+				{
+					assert(term.index == 0 || new_index[term.index] != 0);
+					terms.emplace_back(new_index[term.index], term.coeff);
+				}
+				return pb_linear_combination<FieldT>(terms);
+			};
+			for (const auto& constraint : constraints_)
+			{
+				auto a = remap(constraint.a_);
+				auto b = remap(constraint.b_);
+				auto c = remap(constraint.c_);
+				remapped.add_constraint(std::move(a), std::move(b), std::move(c));
+			}
+			replace_constraints(std::move(remapped));
+
+			variable_set remapped_public;
+			for (const auto& interval : public_wires)
+				for (var_index_t var = boost::icl::first(interval); var <= boost::icl::last(interval); var++)
+					remapped_public.insert(new_index[var]);
+			public_wires = std::move(remapped_public);
+			eliminated_wires.clear();
+
+			r1cs_variable_assignment<FieldT> remapped_assignment = assignment.empty_like();
+			remapped_assignment.resize(num_variables);
+			remapped_assignment[0] = assignment[0];
+			for (var_index_t var = 1; var < next_free_var_; var++)
+			{
+				if (new_index[var] != 0)
+					remapped_assignment[new_index[var]] = assignment[var];
+			}
+			assignment = std::move(remapped_assignment);
+			next_free_var_ = num_variables;
+
+			zero_var_ = new_index[zero_var_];
+			packed_cache_.clear();
+			unpacked_cache_.clear();
+		}
+
+		/**
+		* Makes add_r1cs_constraint drop constraints identical to one already kept in
+		* constraints_, up to the order of a and b, and makes pack_bits and unpack_bits return
+		* the variables of an earlier identical call instead of emitting the same relation over
+		* fresh wires. Constraint rows are only compared while no constraint sink is set.
+		*/
+		void enable_deduplication(bool enable = true)
+		{
+			deduplicate_ = enable;
+		}
+
+		//number of constraints dropped as duplicates of a kept row
+		size_t num_duplicate_constraints() const
+		{
+			return num_duplicates_;
+		}
+
+		//number of pack_bits and unpack_bits calls answered from the caches, whose rows were
+		//never generated
+		size_t num_packing_cache_hits() const
+		{
+			return num_cache_hits_;
+		}
+
 		void add_r1cs_constraint(const r1cs_constraint<FieldT> &constr)
 		{
-			constraints_.emplace_back(constr);
+			add_r1cs_constraint(constr.a_, constr.b_, constr.c_);
 		}
 
 		void add_r1cs_constraint(const pb_linear_combination<FieldT>& a, 
 			const pb_linear_combination<FieldT>& b, const pb_linear_combination<FieldT>& c)
 		{
-			constraints_.emplace_back(a, b, c);
+			if (sink_ || deduplicate_)
+				add_r1cs_constraint(pb_linear_combination<FieldT>(a),
+					pb_linear_combination<FieldT>(b), pb_linear_combination<FieldT>(c));
+			else
+			{
+				constraints_.add_constraint(a, b, c);
+				num_constraints_++;
+			}
+		}
+
+		void add_r1cs_constraint(pb_linear_combination<FieldT>&& a,
+			pb_linear_combination<FieldT>&& b, pb_linear_combination<FieldT>&& c)
+		{
+			if (sink_)
+				sink_->add_constraint(std::move(a), std::move(b), std::move(c));
+			else
+			{
+				if (deduplicate_ && !register_constraint(a, b, c))
+					return;
+				constraints_.add_constraint(std::move(a), std::move(b), std::move(c));
+			}
+			num_constraints_++;
 		}
 
 		static pb_variable<FieldT> idx2var(var_index_t index)
@@ -243,37 +713,67 @@ namespace gadgetlib
 		}
 
 
-		var_index_t pack_bits(var_index_t low, var_index_t high)
+		//wire constrained to zero, allocated on first use and shared by all bits shifted in
+		var_index_t zero_var()
+		{
+			if (zero_var_ == 0)
+			{
+				zero_var_ = get_free_var();
+				add_r1cs_constraint(1, idx2var(zero_var_), 0);
+			}
+			return zero_var_;
+		}
+
+		var_index_t pack_bits(const variable_list& bits)
 		{
+			if (deduplicate_)
+			{
+				auto it = packed_cache_.find(bits);
+				if (it != packed_cache_.end())
+				{
+					num_cache_hits_++;
+					return it->second;
+				}
+			}
 			var_index_t result = get_free_var();
-			FieldT coeff = 1;
+			if (deduplicate_)
+				packed_cache_.emplace(bits, result);
 			pb_linear_combination<FieldT> eq;
-			var_index_t idx = low;
-			while (idx <= high)
+			eq.reserve(bits.size());
+			for (size_t i = 0; i < bits.size(); i++)
 			{
-				eq = eq + pb_linear_term<FieldT>(idx, coeff);
-				coeff *= 2;
-				idx++;
+				if (zero_var_ == 0 || bits[i] != zero_var_)
+					eq += pb_linear_term<FieldT>(bits[i], power_of_two((unsigned)i));
 			}
-			add_r1cs_constraint(1, eq, idx2var(result));
+			add_r1cs_constraint(1, std::move(eq), idx2var(result));
 			return result;
 		}
 		
 		std::pair<var_index_t, var_index_t> unpack_bits(var_index_t packed_var, 
 			uint32_t range)
 		{
+			if (deduplicate_)
+			{
+				auto it = unpacked_cache_.find(std::make_pair(packed_var, range));
+				if (it != unpacked_cache_.end())
+				{
+					num_cache_hits_++;
+					return it->second;
+				}
+			}
 			auto index_range = get_free_var_range(range);
+			if (deduplicate_)
+				unpacked_cache_.emplace(std::make_pair(packed_var, range), index_range);
 			auto idx = index_range.first;
 			pb_linear_combination<FieldT> eq;
-			FieldT coeff = 1;
+			eq.reserve(range);
 			while (idx <= index_range.second)
 			{
 				make_boolean(idx);
-				eq = eq + pb_linear_term<FieldT>(idx, coeff);
-				coeff *= 2;
+				eq += pb_linear_term<FieldT>(idx, power_of_two((unsigned)(idx - index_range.first)));
 				idx++;
 			}
-			add_r1cs_constraint(1, eq, idx2var(packed_var));
+			add_r1cs_constraint(1, std::move(eq), idx2var(packed_var));
 			return index_range;
 		}
 		
@@ -299,49 +799,65 @@ namespace gadgetlib
 			public_wires.insert(var);
 		}
 
+		//both ends are included
 		void add_public_wire_range(var_index_t first, var_index_t last)
 		{
-			auto idx = first;
-			while (idx < last)
-			{
-				public_wires.insert(idx);
-				idx++;
-			}
+			public_wires.insert(variable_interval::closed(first, last));
+		}
+
+		bool is_public_wire(var_index_t var) const
+		{
+			return boost::icl::contains(public_wires, var);
+		}
+
+		size_t num_public_wires() const
+		{
+			return boost::icl::cardinality(public_wires);
 		}
+
+		//all allocated wires except the constant one and the public ones
+		variable_set auxiliary_wires() const
+		{
+			variable_set result;
+			if (next_free_var_ > 1)
+				result.insert(variable_interval::right_open(1, next_free_var_));
+			return result - public_wires - eliminated_wires;
+		}
+
 		void make_boolean(var_index_t var)
 		{
 			add_r1cs_constraint(idx2var(var), 1 - idx2var(var), 0);
 		}
 
-		FieldT compute_packed_assignment(var_index_t low, var_index_t high)
+		FieldT compute_packed_assignment(const variable_list& bits)
 		{
-			var_index_t idx = high;
 			FieldT result = 0;
-			while (idx >= low)
+			for (size_t i = bits.size(); i > 0; i--)
 			{
 				result *= 2;
-				result += assignment[idx--];
+				result += assignment[bits[i - 1]];
 			}
 			return result;
 		}
 
 		void compute_unpacked_assignment(var_index_t whole, std::pair<var_index_t, var_index_t> bits)
 		{
-			var_index_t start = bits.first;
-			var_index_t end = bits.second;
-			FieldT val = assignment[whole];
-			var_index_t idx = start;
-			unsigned index_pos = 0;
-			while (idx <= end)
-			{
-				assignment[idx] = val.get_bit_at_pos(index_pos++);
-				idx++;
-			}
+			const FieldT& val = assignment[whole];
+			assignment.for_each_segment(bits.first, bits.second - bits.first + 1,
+				[&val](FieldT* out, size_t len, size_t offset) { val.get_bits(out, len, offset); });
 		}
 
 		
 	};
 
+	//an unsatisfied row of the constraint system together with the values its sides evaluate to
+	template<typename FieldT>
+	struct r1cs_constraint_failure
+	{
+		size_t index;
+		FieldT a, b, c;
+	};
+
 	template<typename FieldT>
 	struct r1cs_example
 	{
@@ -370,11 +886,17 @@ namespace gadgetlib
 
 		r1cs_example<FieldT>(const protoboard<FieldT>& pboard) :
 			constraint_system(pboard.constraints_), primary_input(pboard.public_wires),
-			assignment(pboard.assignment){}
+			auxiliary_input(pboard.auxiliary_wires()), assignment(pboard.assignment){}
 
-		void dump()
+		//takes over the constraints and the assignment instead of copying them
+		r1cs_example<FieldT>(protoboard<FieldT>&& pboard) :
+			constraint_system(std::move(pboard.constraints_)),
+			primary_input(pboard.public_wires),
+			auxiliary_input(pboard.auxiliary_wires()), assignment(std::move(pboard.assignment)) {}
+
+		void dump() const
 		{
-			for (auto constraint : constraint_system)
+			for (const auto& constraint : constraint_system)
 			{
 				std::cout << "----------------------------------------------------------------\n";
 				constraint.a_.dump();
@@ -385,30 +907,63 @@ namespace gadgetlib
 			}
 		}
 
-		FieldT eval(const pb_linear_combination<FieldT>& elem)
+		FieldT eval(const r1cs_linear_combination_view<FieldT>& elem) const
 		{
-			FieldT val = 0;
-			for (auto& term : elem.terms)
-			{
-				val += term.coeff * assignment[term.index];
-			}
-			return val;
+			return inner_product(elem.begin(), elem.end(), assignment);
 		}
 
-		bool check_assignment()
+		/**
+		* Evaluates every constraint against the assignment and returns all unsatisfied rows in
+		* increasing order. Rows are split into contiguous blocks, one per thread; num_threads = 0
+		* means one per hardware thread.
+		*/
+		std::vector<r1cs_constraint_failure<FieldT>> find_unsatisfied(unsigned num_threads = 0) const
 		{
-			uint32_t counter = 0;
-			for (auto& contstraint : constraint_system)
+			//below this many rows per thread spawning costs more than it saves
+			const size_t MIN_ROWS_PER_THREAD = 4096;
+
+			size_t rows = constraint_system.size();
+			if (num_threads == 0)
+				num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+			num_threads = (unsigned)std::min<size_t>(num_threads,
+				std::max<size_t>(rows / MIN_ROWS_PER_THREAD, 1));
+
+			std::vector<std::vector<r1cs_constraint_failure<FieldT>>> failures(num_threads);
+			auto check_rows = [this, rows, num_threads, &failures](unsigned block)
 			{
-				if ((eval(contstraint.a_) * eval(contstraint.b_)) != eval(contstraint.c_))
+				size_t first = rows * block / num_threads;
+				size_t last = rows * (block + 1) / num_threads;
+				for (size_t i = first; i < last; i++)
 				{
-					std::cout << "failed assumption: " << counter << std::endl;
-					return false;
+					auto constraint = constraint_system[i];
+					FieldT a = eval(constraint.a_);
+					FieldT b = eval(constraint.b_);
+					FieldT c = eval(constraint.c_);
+					if (a * b != c)
+						failures[block].push_back({ i, a, b, c });
 				}
-				else
-					counter++;
-			}
-			return true;
+			};
+
+			std::vector<std::thread> workers;
+			for (unsigned block = 1; block < num_threads; block++)
+				workers.emplace_back(check_rows, block);
+			check_rows(0);
+			for (auto& worker : workers)
+				worker.join();
+
+			std::vector<r1cs_constraint_failure<FieldT>> result = std::move(failures[0]);
+			for (unsigned block = 1; block < num_threads; block++)
+				std::move(failures[block].begin(), failures[block].end(), std::back_inserter(result));
+			return result;
+		}
+
+		bool check_assignment(unsigned num_threads = 0) const
+		{
+			auto failures = find_unsatisfied(num_threads);
+			if (failures.empty())
+				return true;
+			std::cout << "failed assumption: " << failures.front().index << std::endl;
+			return false;
 		}
 	};
 };
@@ -18,12 +18,7 @@ namespace gadgetlib
 	template<typename FieldT>
 	pb_linear_combination<FieldT> pb_variable<FieldT>::operator+(const pb_linear_combination<FieldT> &other) const
 	{
-		pb_linear_combination<FieldT> result;
-
-		result.add_term(*this);
-		result.terms.insert(result.terms.begin(), other.terms.begin(), other.terms.end());
-
-		return result;
+		return pb_linear_combination<FieldT>(*this) + other;
 	}
 
 	template<typename FieldT>
@@ -196,13 +191,13 @@ namespace gadgetlib
 	}
 
 	template<typename FieldT>
-	typename std::vector<pb_linear_term<FieldT> >::const_iterator pb_linear_combination<FieldT>::begin() const
+	typename pb_linear_combination<FieldT>::terms_type::const_iterator pb_linear_combination<FieldT>::begin() const
 	{
 		return terms.begin();
 	}
 
 	template<typename FieldT>
-	typename std::vector<pb_linear_term<FieldT> >::const_iterator pb_linear_combination<FieldT>::end() const
+	typename pb_linear_combination<FieldT>::terms_type::const_iterator pb_linear_combination<FieldT>::end() const
 	{
 		return terms.end();
 	}
@@ -210,25 +205,90 @@ namespace gadgetlib
 	template<typename FieldT>
 	void pb_linear_combination<FieldT>::add_term(const pb_variable<FieldT> &var)
 	{
-		this->terms.emplace_back(pb_linear_term<FieldT>(var.index, FieldT::one()));
+		(*this) += pb_linear_term<FieldT>(var.index, FieldT::one());
 	}
 
 	template<typename FieldT>
 	void pb_linear_combination<FieldT>::add_term(const pb_variable<FieldT> &var, const integer_coeff_t int_coeff)
 	{
-		this->terms.emplace_back(pb_linear_term<FieldT>(var.index, int_coeff));
+		(*this) += pb_linear_term<FieldT>(var.index, int_coeff);
 	}
 
 	template<typename FieldT>
 	void pb_linear_combination<FieldT>::add_term(const pb_variable<FieldT> &var, const FieldT &coeff)
 	{
-		this->terms.emplace_back(pb_linear_term<FieldT>(var.index, coeff));
+		(*this) += pb_linear_term<FieldT>(var.index, coeff);
 	}
 
 	template<typename FieldT>
 	void pb_linear_combination<FieldT>::add_term(const pb_linear_term<FieldT> &other)
 	{
-		this->terms.emplace_back(other);
+		(*this) += other;
+	}
+
+	template<typename FieldT>
+	void pb_linear_combination<FieldT>::reserve(size_t num_terms)
+	{
+		this->terms.reserve(num_terms);
+	}
+
+	template<typename FieldT>
+	pb_linear_combination<FieldT>& pb_linear_combination<FieldT>::operator+=(const pb_linear_term<FieldT> &lt)
+	{
+		if (this->terms.empty() || this->terms.back().index < lt.index)
+		{
+			this->terms.emplace_back(lt);
+			return *this;
+		}
+
+		auto it = std::lower_bound(this->terms.begin(), this->terms.end(), lt.index,
+			[](const pb_linear_term<FieldT>& term, var_index_t index) { return term.index < index; });
+		if (it != this->terms.end() && it->index == lt.index)
+		{
+			it->coeff += lt.coeff;
+			if (!it->coeff)
+				this->terms.erase(it);
+		}
+		else
+			this->terms.insert(it, lt);
+		return *this;
+	}
+
+	template<typename FieldT>
+	pb_linear_combination<FieldT>& pb_linear_combination<FieldT>::operator+=(const pb_linear_combination<FieldT> &other)
+	{
+		if (other.terms.empty())
+			return *this;
+		if (this->terms.empty() || this->terms.back().index < other.terms.front().index)
+		{
+			this->terms.insert(this->terms.end(), other.terms.begin(), other.terms.end());
+			return *this;
+		}
+		this->terms = std::move(((*this) + other).terms);
+		return *this;
+	}
+
+	template<typename FieldT>
+	pb_linear_combination<FieldT>& pb_linear_combination<FieldT>::operator+=(pb_linear_combination<FieldT> &&other)
+	{
+		if (this->terms.empty())
+		{
+			this->terms = std::move(other.terms);
+			return *this;
+		}
+		if (!other.terms.empty() && this->terms.back().index < other.terms.front().index)
+		{
+			this->terms.insert(this->terms.end(), std::make_move_iterator(other.terms.begin()),
+				std::make_move_iterator(other.terms.end()));
+			return *this;
+		}
+		return (*this) += static_cast<const pb_linear_combination<FieldT>&>(other);
+	}
+
+	template<typename FieldT>
+	pb_linear_combination<FieldT>& pb_linear_combination<FieldT>::operator-=(const pb_linear_combination<FieldT> &other)
+	{
+		return (*this) += (-other);
 	}
 
 	template<typename FieldT>
@@ -240,12 +300,12 @@ namespace gadgetlib
 	template<typename FieldT>
 	FieldT pb_linear_combination<FieldT>::evaluate(const std::vector<FieldT> &assignment) const
 	{
-		FieldT acc = FieldT::zero();
-		for (auto &lt : terms)
+		FieldT one = FieldT::one();
+		return inner_product<FieldT>(terms.begin(), terms.end(), 
+			[&assignment, &one](var_index_t index) -> const FieldT&
 		{
-			acc += (lt.index == 0 ? FieldT::one() : assignment[lt.index - 1]) * lt.coeff;
-		}
-		return acc;
+			return (index == 0 ? one : assignment[index - 1]);
+		});
 	}
 
 	template<typename FieldT>
@@ -283,8 +343,10 @@ namespace gadgetlib
 			}
 			else
 			{
-				/* it1->index == it2->index */
-				result.terms.emplace_back(pb_linear_term<FieldT>(pb_variable<FieldT>(it1->index), it1->coeff + it2->coeff));
+				/* it1->index == it2->index; terms that cancel out are dropped */
+				FieldT coeff = it1->coeff + it2->coeff;
+				if (coeff)
+					result.terms.emplace_back(pb_linear_term<FieldT>(pb_variable<FieldT>(it1->index), coeff));
 				++it1;
 				++it2;
 			}
@@ -356,6 +418,37 @@ namespace gadgetlib
 		return pb_linear_combination<FieldT>(field_coeff) - lc;
 	}
 
+	template<typename FieldT, typename TermIterator, typename ValueAccessor>
+	FieldT inner_product(TermIterator first, TermIterator last, ValueAccessor&& value_at)
+	{
+		typename FieldT::accumulator acc;
+		for (; first != last; ++first)
+		{
+			acc.mul_add(first->coeff, value_at(first->index));
+		}
+		return acc.reduce();
+	}
+
+	template<typename FieldT, typename TermIterator>
+	FieldT inner_product(TermIterator first, TermIterator last, 
+		const std::vector<FieldT>& assignment)
+	{
+		return inner_product<FieldT>(first, last, [&assignment](var_index_t index) -> const FieldT&
+		{
+			return assignment[index];
+		});
+	}
+
+	template<typename FieldT, typename TermIterator>
+	FieldT inner_product(TermIterator first, TermIterator last,
+		const chunked_assignment<FieldT>& assignment)
+	{
+		return inner_product<FieldT>(first, last, [&assignment](var_index_t index) -> const FieldT&
+		{
+			return assignment[index];
+		});
+	}
+
 	template<typename FieldT>
 	pb_linear_combination<FieldT>::pb_linear_combination(const std::vector<pb_linear_term<FieldT> > &all_terms)
 	{
@@ -364,9 +457,10 @@ namespace gadgetlib
 			return;
 		}
 
-		terms = all_terms;
+		terms.assign(all_terms.begin(), all_terms.end());
 		std::sort(terms.begin(), terms.end(), [](pb_linear_term<FieldT> a, pb_linear_term<FieldT> b) { return a.index < b.index; });
 
+		//merge runs of equal indices, then drop the runs whose coefficients cancel out
 		auto result_it = terms.begin();
 		for (auto it = ++terms.begin(); it != terms.end(); ++it)
 		{
@@ -380,6 +474,8 @@ namespace gadgetlib
 			}
 		}
 		terms.resize((result_it - terms.begin()) + 1);
+		terms.erase(std::remove_if(terms.begin(), terms.end(),
+			[](const pb_linear_term<FieldT>& term) { return !term.coeff; }), terms.end());
 	}
 }
 
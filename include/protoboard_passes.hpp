@@ -0,0 +1,286 @@
+#ifndef PROTOBOARD_PASSES_HPP_
+#define PROTOBOARD_PASSES_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <utility>
+
+#include "protoboard.hpp"
+
+/**
+* Optimisation passes over a finished protoboard, i.e. one the engraver will not add to any
+* more. They rewrite pboard.constraints_ in place, so constraints must have been kept on the
+* protoboard rather than sent to a constraint sink.
+*/
+
+namespace gadgetlib
+{
+	namespace passes_detail
+	{
+		template<typename FieldT>
+		using sparse_lc = std::vector<r1cs_term<FieldT>>;
+
+		template<typename FieldT>
+		using sparse_row = std::array<sparse_lc<FieldT>, 3>;
+
+		template<typename FieldT>
+		sparse_lc<FieldT> to_sparse(const r1cs_linear_combination_view<FieldT>& lc)
+		{
+			sparse_lc<FieldT> result;
+			result.reserve(lc.size());
+			for (const auto& term : lc)
+			{
+				if (term.coeff)
+					result.push_back(term);
+			}
+			return result;
+		}
+
+		template<typename FieldT, typename LC>
+		pb_linear_combination<FieldT> to_pb(const LC& lc)
+		{
+			pb_linear_combination<FieldT> result;
+			result.reserve(lc.size());
+			for (const auto& term : lc)
+				result += pb_linear_term<FieldT>(term.index, term.coeff);
+			return result;
+		}
+
+		template<typename FieldT>
+		const r1cs_term<FieldT>* find(const sparse_lc<FieldT>& lc, uint32_t index)
+		{
+			auto it = std::lower_bound(lc.begin(), lc.end(), index,
+				[](const r1cs_term<FieldT>& term, uint32_t idx) { return term.index < idx; });
+			return (it != lc.end() && it->index == index) ? &*it : nullptr;
+		}
+
+		//lhs + factor * rhs, with cancelled terms dropped
+		template<typename FieldT>
+		sparse_lc<FieldT> add_scaled(const sparse_lc<FieldT>& lhs, const FieldT& factor,
+			const sparse_lc<FieldT>& rhs)
+		{
+			sparse_lc<FieldT> result;
+			result.reserve(lhs.size() + rhs.size());
+			auto first = lhs.begin();
+			auto second = rhs.begin();
+			while (first != lhs.end() || second != rhs.end())
+			{
+				if (second == rhs.end() || (first != lhs.end() && first->index < second->index))
+					result.push_back(*first++);
+				else if (first == lhs.end() || second->index < first->index)
+				{
+					result.emplace_back(second->index, factor * second->coeff);
+					++second;
+				}
+				else
+				{
+					FieldT coeff = first->coeff + factor * second->coeff;
+					if (coeff)
+						result.emplace_back(first->index, coeff);
+					++first;
+					++second;
+				}
+			}
+			return result;
+		}
+
+		//if one side of the constraint is a constant k, returns true and sets k * other - c
+		template<typename FieldT>
+		bool as_linear(const sparse_row<FieldT>& row, sparse_lc<FieldT>& result)
+		{
+			for (unsigned side = 0; side < 2; side++)
+			{
+				const auto& lc = row[side];
+				if (lc.size() > 1 || (lc.size() == 1 && lc[0].index != 0))
+					continue;
+				FieldT k = lc.empty() ? FieldT(0) : lc[0].coeff;
+				result = add_scaled(sparse_lc<FieldT>(), FieldT(0) - FieldT(1), row[2]);
+				if (k)
+					result = add_scaled(result, k, row[1 - side]);
+				return true;
+			}
+			return false;
+		}
+	}
+
+	/**
+	* Removes linear constraints (those with a constant a or b) by solving each for one of its
+	* non-public variables and substituting the solution into every other constraint using
+	* that variable. A substitution is only done if no linear combination would grow beyond
+	* max_terms terms, which keeps the remaining rows sparse. Eliminated variables are passed
+	* to pboard.eliminate_wire, so gadgets incorporated afterwards do not reuse them; the
+	* assignment stays valid as is, since the values of the remaining variables are unchanged.
+	* Returns the number of removed constraints.
+	*/
+	template<typename FieldT>
+	size_t eliminate_linear_constraints(protoboard<FieldT>& pboard, size_t max_terms = 32)
+	{
+		using namespace passes_detail;
+		assert(pboard.constraints_.size() == pboard.num_constraints());
+
+		const auto& constraints = pboard.constraints_;
+		size_t num_rows = constraints.size();
+		std::vector<sparse_row<FieldT>> rows;
+		rows.reserve(num_rows);
+		//rows each variable occurs in (the constant one is never solved for, so it is not
+		//tracked); entries may go stale or repeat when terms cancel
+		std::vector<std::vector<uint32_t>> occurrences(pboard.next_free_var_);
+		auto add_occurrence = [&occurrences](uint32_t index, uint32_t row)
+		{
+			auto& list = occurrences[index];
+			if (index != 0 && (list.empty() || list.back() != row))
+				list.push_back(row);
+		};
+		for (size_t i = 0; i < num_rows; i++)
+		{
+			auto constraint = constraints[i];
+			rows.push_back({ to_sparse(constraint.a_), to_sparse(constraint.b_),
+				to_sparse(constraint.c_) });
+			for (const auto& lc : rows.back())
+				for (const auto& term : lc)
+					add_occurrence(term.index, (uint32_t)i);
+		}
+
+		std::vector<bool> removed(num_rows, false);
+		size_t num_removed = 0;
+		sparse_lc<FieldT> definition;
+		std::vector<std::pair<size_t, uint32_t>> candidates;
+
+		for (size_t i = 0; i < num_rows; i++)
+		{
+			if (!as_linear(rows[i], definition))
+				continue;
+			//0 = 0 carries no information; a nonzero constant is kept so the system stays
+			//unsatisfiable
+			if (definition.empty())
+			{
+				removed[i] = true;
+				num_removed++;
+				continue;
+			}
+
+			//variables solvable for, the rarest first
+			candidates.clear();
+			for (const auto& term : definition)
+			{
+				if (term.index != 0 && !pboard.is_public_wire(term.index))
+					candidates.emplace_back(occurrences[term.index].size(), term.index);
+			}
+			std::sort(candidates.begin(), candidates.end());
+
+			for (const auto& candidate : candidates)
+			{
+				uint32_t pivot = candidate.second;
+				bool fits = true;
+				for (uint32_t other : occurrences[pivot])
+				{
+					if (other == i || removed[other])
+						continue;
+					for (const auto& lc : rows[other])
+						if (find(lc, pivot) && lc.size() + definition.size() - 2 > max_terms)
+							fits = false;
+				}
+				if (!fits)
+					continue;
+
+				//pivot = factor * (definition - coeff * pivot)
+				FieldT factor = FieldT(0) - find(definition, pivot)->coeff.inverse();
+				for (uint32_t other : occurrences[pivot])
+				{
+					if (other == i || removed[other])
+						continue;
+					for (auto& lc : rows[other])
+					{
+						const auto* term = find(lc, pivot);
+						if (!term)
+							continue;
+						//adding (coeff * factor) * definition cancels the pivot exactly
+						lc = add_scaled(lc, term->coeff * factor, definition);
+					}
+					for (const auto& term : definition)
+						if (term.index != pivot)
+							add_occurrence(term.index, other);
+				}
+				occurrences[pivot].clear();
+				pboard.eliminate_wire(pivot);
+				removed[i] = true;
+				num_removed++;
+				break;
+			}
+		}
+
+		r1cs_constraint_system<FieldT> reduced;
+		for (size_t i = 0; i < num_rows; i++)
+		{
+			if (!removed[i])
+				reduced.add_constraint(to_pb<FieldT>(rows[i][0]), to_pb<FieldT>(rows[i][1]),
+					to_pb<FieldT>(rows[i][2]));
+		}
+		pboard.replace_constraints(std::move(reduced));
+		return num_removed;
+	}
+
+	/**
+	* Renumbers the wires as most provers expect them: the constant one, then the public wires,
+	* then the auxiliary ones in the order the constraints first use them (wires no constraint
+	* uses come last). Eliminated wires are dropped. With sort_constraints the rows are also
+	* stably sorted by the highest wire they use, so checking them walks the assignment
+	* front to back.
+	*/
+	template<typename FieldT>
+	void renumber_variables(protoboard<FieldT>& pboard, bool sort_constraints = false)
+	{
+		std::vector<var_index_t> new_index(pboard.next_free_var_, 0);
+		var_index_t next = 1;
+		auto number = [&](var_index_t var)
+		{
+			if (var != 0 && new_index[var] == 0)
+				new_index[var] = next++;
+		};
+
+		for (const auto& interval : pboard.public_wires)
+			for (var_index_t var = boost::icl::first(interval); var <= boost::icl::last(interval); var++)
+				number(var);
+		for (const auto& constraint : pboard.constraints_)
+			for (const auto* lc : { &constraint.a_, &constraint.b_, &constraint.c_ })
+				for (const auto& term : *lc)
+					number(term.index);
+		for (const auto& interval : pboard.auxiliary_wires())
+			for (var_index_t var = boost::icl::first(interval); var <= boost::icl::last(interval); var++)
+				number(var);
+
+		pboard.remap_variables(new_index, next);
+		if (!sort_constraints)
+			return;
+
+		const auto& constraints = pboard.constraints_;
+		std::vector<std::pair<uint32_t, uint32_t>> order;
+		order.reserve(constraints.size());
+		for (size_t i = 0; i < constraints.size(); i++)
+		{
+			auto constraint = constraints[i];
+			uint32_t last = 0;
+			for (const auto* lc : { &constraint.a_, &constraint.b_, &constraint.c_ })
+				if (!lc->empty())
+					last = std::max(last, (lc->end() - 1)->index);
+			order.emplace_back(last, (uint32_t)i);
+		}
+		std::stable_sort(order.begin(), order.end(),
+			[](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+		r1cs_constraint_system<FieldT> sorted;
+		sorted.reserve(constraints.size(), constraints.num_terms());
+		for (const auto& elem : order)
+		{
+			auto constraint = constraints[elem.second];
+			sorted.add_constraint(passes_detail::to_pb<FieldT>(constraint.a_),
+				passes_detail::to_pb<FieldT>(constraint.b_), passes_detail::to_pb<FieldT>(constraint.c_));
+		}
+		pboard.replace_constraints(std::move(sorted));
+	}
+}
+
+#endif
@@ -0,0 +1,476 @@
+#ifndef R1CS_EXPORT_HPP_
+#define R1CS_EXPORT_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <utility>
+
+#include "protoboard.hpp"
+#include "mapped_file.hpp"
+
+/**
+* Binary export of circuits in the iden3 .r1cs and .wtns layouts (as used by circom and
+* snarkjs). Both are sectioned files: a 4-byte magic, a uint32 version and a uint32 section
+* count, then sections of (uint32 type, uint64 byte size, contents). All integers are
+* little-endian, field elements are little-endian canonical representatives padded to n8 bytes,
+* n8 being FieldT::byte_size() rounded up to a multiple of 8.
+*
+* iden3 wire 0 is the constant one, followed by the public wires and then by all the other ones,
+* each group in protoboard order; every wire is labelled with its protoboard index. Wires removed
+* by eliminate_linear_constraints are left out. Readers return indices in iden3 numbering.
+*/
+
+namespace gadgetlib
+{
+	namespace iden3_detail
+	{
+		enum r1cs_section : uint32_t { R1CS_HEADER = 1, R1CS_CONSTRAINTS = 2, R1CS_WIRE2LABEL = 3 };
+		enum wtns_section : uint32_t { WTNS_HEADER = 1, WTNS_DATA = 2 };
+
+		const uint32_t R1CS_VERSION = 1;
+		const uint32_t WTNS_VERSION = 2;
+		const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+		template<typename FieldT>
+		size_t field_width()
+		{
+			return (FieldT::byte_size() + 7) / 8 * 8;
+		}
+
+		template<typename FieldT>
+		std::vector<uint8_t> modulus_bytes()
+		{
+			//p = (p - 1) + 1, done on the little-endian bytes
+			std::vector<uint8_t> result = (FieldT(0) - FieldT(1)).to_bytes();
+			result.resize(field_width<FieldT>(), 0);
+			for (auto& byte : result)
+				if (++byte != 0)
+					break;
+			return result;
+		}
+
+		class binary_writer
+		{
+		public:
+			explicit binary_writer(const std::string& path) : buffer_(WRITE_BUFFER_SIZE)
+			{
+				out_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+				out_.open(path, std::ios::binary | std::ios::trunc);
+				if (!out_)
+					throw std::runtime_error("iden3 export: cannot open " + path);
+			}
+
+			void write_bytes(const void* data, size_t size)
+			{
+				out_.write(static_cast<const char*>(data), size);
+			}
+
+			void write_uint32(uint32_t val)
+			{
+				uint8_t bytes[4];
+				for (unsigned i = 0; i < 4; i++)
+					bytes[i] = uint8_t(val >> (8 * i));
+				write_bytes(bytes, 4);
+			}
+
+			void write_uint64(uint64_t val)
+			{
+				uint8_t bytes[8];
+				for (unsigned i = 0; i < 8; i++)
+					bytes[i] = uint8_t(val >> (8 * i));
+				write_bytes(bytes, 8);
+			}
+
+			template<typename FieldT>
+			void write_field(const FieldT& val, size_t width)
+			{
+				std::vector<uint8_t> bytes = val.to_bytes();
+				bytes.resize(width, 0);
+				write_bytes(bytes.data(), width);
+			}
+
+			bool good() const { return (bool)out_; }
+
+			void section(uint32_t type, uint64_t size)
+			{
+				write_uint32(type);
+				write_uint64(size);
+			}
+
+			void close()
+			{
+				out_.close();
+				if (out_.fail())
+					throw std::runtime_error("iden3 export: write failed");
+			}
+
+		private:
+			std::vector<char> buffer_;
+			std::ofstream out_;
+		};
+
+		//calls func(protoboard index) for every wire, in iden3 order
+		template<typename FieldT, typename Func>
+		void for_each_wire(const protoboard<FieldT>& pboard, Func&& func)
+		{
+			func(var_index_t(0));
+			for (const auto& interval : pboard.public_wires)
+				for (var_index_t var = boost::icl::first(interval); var <= boost::icl::last(interval); var++)
+					func(var);
+			for (const auto& interval : pboard.auxiliary_wires())
+				for (var_index_t var = boost::icl::first(interval); var <= boost::icl::last(interval); var++)
+					func(var);
+		}
+
+		//number of wires for_each_wire visits
+		template<typename FieldT>
+		uint32_t count_wires(const protoboard<FieldT>& pboard)
+		{
+			return (uint32_t)(1 + pboard.num_public_wires() +
+				boost::icl::cardinality(pboard.auxiliary_wires()));
+		}
+
+		inline uint32_t read_uint32(const uint8_t* data)
+		{
+			uint32_t result = 0;
+			for (unsigned i = 4; i > 0; i--)
+				result = (result << 8) | data[i - 1];
+			return result;
+		}
+
+		inline uint64_t read_uint64(const uint8_t* data)
+		{
+			uint64_t result = 0;
+			for (unsigned i = 8; i > 0; i--)
+				result = (result << 8) | data[i - 1];
+			return result;
+		}
+
+		/**
+		* Decodes one linear combination of the constraints layout (uint32 term count, then
+		* uint32 wire index and width-byte coefficient per term) starting at pos, and returns
+		* the position after it. Throws std::runtime_error if it runs past end.
+		*/
+		template<typename FieldT>
+		const uint8_t* read_linear_combination(const uint8_t* pos, const uint8_t* end, size_t width,
+			pb_linear_combination<FieldT>& lc)
+		{
+			if (end - pos < 4)
+				throw std::runtime_error("iden3 import: truncated constraint");
+			uint32_t num_terms = read_uint32(pos);
+			pos += 4;
+			if ((size_t)(end - pos) / (4 + width) < num_terms)
+				throw std::runtime_error("iden3 import: truncated constraint");
+			lc.reserve(num_terms);
+			for (uint32_t i = 0; i < num_terms; i++)
+			{
+				var_index_t index = read_uint32(pos);
+				lc += pb_linear_term<FieldT>(index, FieldT::from_bytes(pos + 4, width));
+				pos += 4 + width;
+			}
+			return pos;
+		}
+
+		/**
+		* Whole file mapped read-only and split into sections; throws std::runtime_error on
+		* a wrong magic or a truncated file.
+		*/
+		class mapped_sections
+		{
+		public:
+			mapped_sections(const std::string& path, const char* magic)
+			{
+				file_ = utils::mapped_file::open_read_only(path);
+				size_ = (size_t)file_.size();
+				if (size_ < 12)
+					throw std::runtime_error("iden3 import: " + path + " is too short");
+				view_.map(file_, size_);
+				data_ = view_.data;
+				if (!std::equal(magic, magic + 4, data_))
+					throw std::runtime_error("iden3 import: " + path + " has a wrong magic");
+
+				uint32_t num_sections = read_uint32(data_ + 8);
+				size_t pos = 12;
+				for (uint32_t i = 0; i < num_sections; i++)
+				{
+					if (size_ - pos < 12)
+						throw std::runtime_error("iden3 import: " + path + " is truncated");
+					uint32_t type = read_uint32(data_ + pos);
+					uint64_t length = read_uint64(data_ + pos + 4);
+					pos += 12;
+					if (size_ - pos < length)
+						throw std::runtime_error("iden3 import: " + path + " is truncated");
+					sections_[type] = std::make_pair(data_ + pos, (size_t)length);
+					pos += (size_t)length;
+				}
+			}
+
+			mapped_sections(const mapped_sections&) = delete;
+			mapped_sections& operator=(const mapped_sections&) = delete;
+
+			uint32_t version() const { return read_uint32(data_ + 4); }
+
+			//start and size of the section of the given type
+			std::pair<const uint8_t*, size_t> section(uint32_t type) const
+			{
+				auto it = sections_.find(type);
+				if (it == sections_.end())
+					throw std::runtime_error("iden3 import: missing section " + std::to_string(type));
+				return it->second;
+			}
+
+		private:
+			//owns the view, so that it is also unmapped when the constructor throws
+			struct view
+			{
+				const uint8_t* data = nullptr;
+				size_t size = 0;
+
+				void map(utils::mapped_file& file, size_t length)
+				{
+					data = static_cast<const uint8_t*>(file.map(0, length));
+					size = length;
+				}
+
+				~view()
+				{
+					if (data)
+						utils::mapped_file::unmap(const_cast<uint8_t*>(data), size);
+				}
+			};
+
+			utils::mapped_file file_;
+			view view_;
+			const uint8_t* data_ = nullptr;
+			size_t size_ = 0;
+			std::map<uint32_t, std::pair<const uint8_t*, size_t>> sections_;
+		};
+	}
+
+	/**
+	* Writes the constraints kept on pboard (i.e. generated without a constraint sink) to path.
+	*/
+	template<typename FieldT>
+	void write_r1cs(const protoboard<FieldT>& pboard, const std::string& path)
+	{
+		using namespace iden3_detail;
+		assert(pboard.constraints_.size() == pboard.num_constraints());
+
+		const size_t width = field_width<FieldT>();
+		const auto& constraints = pboard.constraints_;
+
+		uint32_t num_wires = count_wires(pboard);
+
+		//indexed by protoboard wire; eliminated wires must occur in no constraint and get no id
+		const uint32_t NO_WIRE = std::numeric_limits<uint32_t>::max();
+		std::vector<uint32_t> wire_ids(pboard.next_free_var_, NO_WIRE);
+		std::vector<uint64_t> labels;
+		labels.reserve(num_wires);
+		for_each_wire(pboard, [&](var_index_t var)
+		{
+			wire_ids[var] = (uint32_t)labels.size();
+			labels.push_back(var);
+		});
+
+		binary_writer out(path);
+		out.write_bytes("r1cs", 4);
+		out.write_uint32(R1CS_VERSION);
+		out.write_uint32(3);
+
+		out.section(R1CS_HEADER, 4 + width + 4 * 4 + 8 + 4);
+		out.write_uint32((uint32_t)width);
+		auto modulus = modulus_bytes<FieldT>();
+		out.write_bytes(modulus.data(), width);
+		out.write_uint32(num_wires);
+		out.write_uint32(0);
+		out.write_uint32((uint32_t)pboard.num_public_wires());
+		out.write_uint32(0);
+		out.write_uint64(num_wires);
+		out.write_uint32((uint32_t)constraints.size());
+
+		out.section(R1CS_CONSTRAINTS, 12 * (uint64_t)constraints.size() +
+			(4 + width) * (uint64_t)constraints.num_terms());
+		//terms go out sorted by their new wire id
+		std::vector<std::pair<uint32_t, const FieldT*>> terms;
+		auto write_lc = [&](const r1cs_linear_combination_view<FieldT>& lc)
+		{
+			terms.clear();
+			for (const auto& term : lc)
+			{
+				if (wire_ids[term.index] == NO_WIRE)
+					throw std::runtime_error("iden3 export: a constraint uses the eliminated wire " +
+						std::to_string(term.index));
+				terms.emplace_back(wire_ids[term.index], &term.coeff);
+			}
+			std::sort(terms.begin(), terms.end(),
+				[](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+			out.write_uint32((uint32_t)terms.size());
+			for (const auto& term : terms)
+			{
+				out.write_uint32(term.first);
+				out.write_field(*term.second, width);
+			}
+		};
+		for (const auto& constraint : constraints)
+		{
+			write_lc(constraint.a_);
+			write_lc(constraint.b_);
+			write_lc(constraint.c_);
+		}
+
+		out.section(R1CS_WIRE2LABEL, 8 * (uint64_t)num_wires);
+		for (uint64_t label : labels)
+			out.write_uint64(label);
+		out.close();
+	}
+
+	/**
+	* Writes the assignment of pboard to path, in the wire order of write_r1cs.
+	*/
+	template<typename FieldT>
+	void write_wtns(const protoboard<FieldT>& pboard, const std::string& path)
+	{
+		using namespace iden3_detail;
+		const size_t width = field_width<FieldT>();
+		uint32_t num_wires = count_wires(pboard);
+
+		binary_writer out(path);
+		out.write_bytes("wtns", 4);
+		out.write_uint32(WTNS_VERSION);
+		out.write_uint32(2);
+
+		out.section(WTNS_HEADER, 4 + width + 4);
+		out.write_uint32((uint32_t)width);
+		auto modulus = modulus_bytes<FieldT>();
+		out.write_bytes(modulus.data(), width);
+		out.write_uint32(num_wires);
+
+		out.section(WTNS_DATA, width * (uint64_t)num_wires);
+		for_each_wire(pboard, [&](var_index_t var) { out.write_field(pboard.assignment[var], width); });
+		out.close();
+	}
+
+	/**
+	* Memory-mapped .r1cs file. Throws std::runtime_error if the file is malformed or its
+	* field differs from FieldT.
+	*/
+	template<typename FieldT>
+	class r1cs_file_reader
+	{
+	public:
+		explicit r1cs_file_reader(const std::string& path) : file_(path, "r1cs")
+		{
+			auto header = file_.section(iden3_detail::R1CS_HEADER);
+			width_ = iden3_detail::read_uint32(header.first);
+			if (header.second != 4 + width_ + 4 * 4 + 8 + 4)
+				throw std::runtime_error("iden3 import: malformed r1cs header");
+			auto modulus = iden3_detail::modulus_bytes<FieldT>();
+			if (width_ != modulus.size() ||
+				!std::equal(modulus.begin(), modulus.end(), header.first + 4))
+				throw std::runtime_error("iden3 import: r1cs file is over a different field");
+
+			const uint8_t* pos = header.first + 4 + width_;
+			num_wires_ = iden3_detail::read_uint32(pos);
+			num_public_outputs_ = iden3_detail::read_uint32(pos + 4);
+			num_public_inputs_ = iden3_detail::read_uint32(pos + 8);
+			num_private_inputs_ = iden3_detail::read_uint32(pos + 12);
+			num_constraints_ = iden3_detail::read_uint32(pos + 24);
+		}
+
+		size_t field_width() const { return width_; }
+		uint32_t num_wires() const { return num_wires_; }
+		uint32_t num_public_outputs() const { return num_public_outputs_; }
+		uint32_t num_public_inputs() const { return num_public_inputs_; }
+		uint32_t num_private_inputs() const { return num_private_inputs_; }
+		uint32_t num_constraints() const { return num_constraints_; }
+
+		r1cs_constraint_system<FieldT> read_constraints() const
+		{
+			auto section = file_.section(iden3_detail::R1CS_CONSTRAINTS);
+			const uint8_t* pos = section.first;
+			const uint8_t* end = section.first + section.second;
+			auto read_lc = [&]()
+			{
+				pb_linear_combination<FieldT> lc;
+				pos = iden3_detail::read_linear_combination(pos, end, width_, lc);
+				return lc;
+			};
+
+			r1cs_constraint_system<FieldT> result;
+			for (uint32_t i = 0; i < num_constraints_; i++)
+			{
+				auto a = read_lc();
+				auto b = read_lc();
+				auto c = read_lc();
+				result.add_constraint(std::move(a), std::move(b), std::move(c));
+			}
+			return result;
+		}
+
+		//label of every wire; for files written by write_r1cs, its protoboard index
+		std::vector<uint64_t> read_wire_labels() const
+		{
+			auto section = file_.section(iden3_detail::R1CS_WIRE2LABEL);
+			if (section.second != 8 * (size_t)num_wires_)
+				throw std::runtime_error("iden3 import: malformed wire map");
+			std::vector<uint64_t> result(num_wires_);
+			for (uint32_t i = 0; i < num_wires_; i++)
+				result[i] = iden3_detail::read_uint64(section.first + 8 * i);
+			return result;
+		}
+
+	private:
+		iden3_detail::mapped_sections file_;
+		size_t width_;
+		uint32_t num_wires_, num_public_outputs_, num_public_inputs_, num_private_inputs_;
+		uint32_t num_constraints_;
+	};
+
+	/**
+	* Memory-mapped .wtns file; values are decoded on access.
+	*/
+	template<typename FieldT>
+	class wtns_file_reader
+	{
+	public:
+		explicit wtns_file_reader(const std::string& path) : file_(path, "wtns")
+		{
+			auto header = file_.section(iden3_detail::WTNS_HEADER);
+			width_ = iden3_detail::read_uint32(header.first);
+			if (header.second != 4 + width_ + 4)
+				throw std::runtime_error("iden3 import: malformed wtns header");
+			auto modulus = iden3_detail::modulus_bytes<FieldT>();
+			if (width_ != modulus.size() ||
+				!std::equal(modulus.begin(), modulus.end(), header.first + 4))
+				throw std::runtime_error("iden3 import: wtns file is over a different field");
+			size_ = iden3_detail::read_uint32(header.first + 4 + width_);
+
+			auto data = file_.section(iden3_detail::WTNS_DATA);
+			if (data.second != width_ * (size_t)size_)
+				throw std::runtime_error("iden3 import: malformed witness section");
+			values_ = data.first;
+		}
+
+		uint32_t size() const { return size_; }
+
+		FieldT operator[](size_t idx) const
+		{
+			return FieldT::from_bytes(values_ + idx * width_, width_);
+		}
+
+	private:
+		iden3_detail::mapped_sections file_;
+		size_t width_;
+		uint32_t size_;
+		const uint8_t* values_;
+	};
+}
+
+#endif
@@ -1,7 +1,318 @@
 #include "gadget.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <unordered_set>
+
 using namespace gadgetlib;
 
+namespace
+{
+	//generations of the arenas that exist and were not cleared since - arenas of any thread
+	//register here, as a gadget may be engraved on another thread than it was built
+	std::mutex& generations_mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	std::unordered_set<uint64_t>& live_generations()
+	{
+		static std::unordered_set<uint64_t> generations;
+		return generations;
+	}
+
+	uint64_t issue_generation()
+	{
+		//0 is never issued
+		static std::atomic<uint64_t> next_generation(1);
+		uint64_t generation = next_generation++;
+		std::lock_guard<std::mutex> lock(generations_mutex());
+		live_generations().insert(generation);
+		return generation;
+	}
+
+	void retire_generation(uint64_t generation)
+	{
+		std::lock_guard<std::mutex> lock(generations_mutex());
+		live_generations().erase(generation);
+	}
+}
+
+node_arena::node_arena() : generation_(issue_generation()) {}
+
+node_arena::~node_arena()
+{
+	destroy_nodes();
+	retire_generation(generation_);
+}
+
+bool node_arena::is_live(uint64_t generation)
+{
+	std::lock_guard<std::mutex> lock(generations_mutex());
+	return live_generations().count(generation) != 0;
+}
+
+void node_arena::clear()
+{
+	destroy_nodes();
+	retire_generation(generation_);
+	generation_ = issue_generation();
+}
+
+void node_arena::destroy_nodes()
+{
+	for (abstract_node* node : nodes_)
+		node->~abstract_node();
+	nodes_.clear();
+	blocks_.clear();
+	block_used_ = BLOCK_SIZE;
+	interned_.clear();
+	num_interned_ = 0;
+}
+
+void* node_arena::allocate(size_t size, size_t alignment)
+{
+	assert(size <= BLOCK_SIZE && alignment <= alignof(std::max_align_t));
+	size_t offset = (block_used_ + alignment - 1) & ~(alignment - 1);
+	if (offset + size > BLOCK_SIZE)
+	{
+		blocks_.emplace_back(new char[BLOCK_SIZE]);
+		offset = 0;
+	}
+	block_used_ = offset + size;
+	return blocks_.back().get() + offset;
+}
+
+abstract_node* node_arena::intern(const op_node& node)
+{
+	if (!interning_)
+		return make<op_node>(node);
+
+	op_key key = { (uint32_t)node.op_kind_, node.first_child_, node.second_child_,
+		node.third_child_, node.param_, node.additional_param_ };
+	switch (node.op_kind_)
+	{
+	case OP_KIND::PLUS:
+	case OP_KIND::MUL:
+	case OP_KIND::CONJUNCTION:
+	case OP_KIND::XOR:
+	case OP_KIND::DISJUNCTION:
+	case OP_KIND::EQ:
+	case OP_KIND::NON_TERMINAL_EQ:
+	case OP_KIND::ALL:
+		if (key[1] > key[2])
+			std::swap(key[1], key[2]);
+		break;
+	default:
+		break;
+	}
+
+	auto it = interned_.find(key);
+	if (it != interned_.end())
+	{
+		num_interned_++;
+		return nodes_[it->second];
+	}
+	op_node* result = make<op_node>(node);
+	interned_.emplace(key, result->id_);
+	return result;
+}
+
+namespace
+{
+	//bits of a fixed-width constant, least significant first
+	std::vector<bool> to_bits(const abstract_node* node)
+	{
+		auto* constant = static_cast<const const_node*>(node);
+		std::vector<bool> result(node->bitsize_);
+		for (uint32_t i = 0; i < node->bitsize_; i++)
+			result[i] = constant->value_.get_bit(i);
+		return result;
+	}
+
+	abstract_node* make_constant(const std::vector<bool>& bits)
+	{
+		std::vector<uint8_t> bytes((bits.size() + 7) / 8, 0);
+		for (size_t i = 0; i < bits.size(); i++)
+		{
+			if (bits[i])
+				bytes[i / 8] |= (uint8_t)(1 << (i % 8));
+		}
+		return node_arena::current().make<const_node>(node_value(bytes.data(), bytes.size()),
+			(uint32_t)bits.size());
+	}
+
+	bool is_fixed_width_constant(const abstract_node* node)
+	{
+		return (node->node_kind_ == NODE_KIND::CONSTANT_GADGET) &&
+			(node->type_ != NODE_TYPE::FIELD_NODE);
+	}
+}
+
+abstract_node* gadget::fold(const op_node& node)
+{
+	const node_arena& arena = node_arena::current();
+	if (node.op_kind_ == OP_KIND::ITE)
+	{
+		const abstract_node* condition = arena.get(node.first_child_);
+		if (condition->node_kind_ != NODE_KIND::CONSTANT_GADGET)
+			return nullptr;
+		return arena.get(static_cast<const const_node*>(condition)->value_.get_bit(0) ?
+			node.second_child_ : node.third_child_);
+	}
+
+	//comparisons and field operations are left to the engraver
+	if (node.type_ != NODE_TYPE::FIXED_WIDTH_INTEGER_NODE)
+		return nullptr;
+	const abstract_node* first = arena.get(node.first_child_);
+	const abstract_node* second = (node.second_child_ != NULL_NODE ?
+		arena.get(node.second_child_) : nullptr);
+	if (!is_fixed_width_constant(first) || (second && !is_fixed_width_constant(second)))
+		return nullptr;
+
+	std::vector<bool> a = to_bits(first);
+	std::vector<bool> b = (second ? to_bits(second) : std::vector<bool>());
+	std::vector<bool> result(node.bitsize_);
+	uint32_t size = node.bitsize_;
+
+	switch (node.op_kind_)
+	{
+	case (OP_KIND::PLUS):
+	case (OP_KIND::MINUS):
+	{
+		//a + b is reduced modulo 2^size, as the engraver does; a - b is a + ~b + 1
+		bool carry = (node.op_kind_ == OP_KIND::MINUS);
+		for (uint32_t i = 0; i < size; i++)
+		{
+			bool y = (node.op_kind_ == OP_KIND::MINUS ? !b[i] : b[i]);
+			result[i] = a[i] ^ y ^ carry;
+			carry = (a[i] && y) || (carry && (a[i] ^ y));
+		}
+		//the engraver lowers a - b as a field subtraction, which has no value on size bits
+		//when a < b (no carry out): left unfolded, so that folding keeps the verdict
+		if (node.op_kind_ == OP_KIND::MINUS && !carry)
+			return nullptr;
+		break;
+	}
+	case (OP_KIND::CONJUNCTION):
+	case (OP_KIND::XOR):
+	case (OP_KIND::DISJUNCTION):
+		for (uint32_t i = 0; i < size; i++)
+		{
+			if (node.op_kind_ == OP_KIND::CONJUNCTION)
+				result[i] = a[i] && b[i];
+			else if (node.op_kind_ == OP_KIND::XOR)
+				result[i] = a[i] != b[i];
+			else
+				result[i] = a[i] || b[i];
+		}
+		break;
+	case (OP_KIND::NOT):
+		for (uint32_t i = 0; i < size; i++)
+			result[i] = !a[i];
+		break;
+	case (OP_KIND::INDEX):
+	{
+		//bits are numbered from the most significant one
+		uint32_t start = first->bitsize_ - node.additional_param_ - 1;
+		for (uint32_t i = 0; i < size; i++)
+			result[i] = a[start + i];
+		break;
+	}
+	case (OP_KIND::SHR):
+		for (uint32_t i = 0; i < size; i++)
+			result[i] = (i + node.param_ < size) && a[i + node.param_];
+		break;
+	case (OP_KIND::ROTATE_LEFT):
+	case (OP_KIND::ROTATE_RIGHT):
+	{
+		uint32_t shift = (node.op_kind_ == OP_KIND::ROTATE_RIGHT ? node.param_ :
+			size - node.param_) % size;
+		for (uint32_t i = 0; i < size; i++)
+			result[i] = a[(i + shift) % size];
+		break;
+	}
+	case (OP_KIND::CONCATENATION):
+		//the second argument forms the low bits
+		std::copy(b.begin(), b.end(), result.begin());
+		std::copy(a.begin(), a.end(), result.begin() + b.size());
+		break;
+	case (OP_KIND::EXTEND):
+		std::copy(a.begin(), a.end(), result.begin());
+		break;
+	default:
+		return nullptr;
+	}
+	return make_constant(result);
+}
+
+node_arena*& node_arena::current_ptr()
+{
+	thread_local node_arena thread_arena;
+	thread_local node_arena* current = &thread_arena;
+	return current;
+}
+
+node_arena& node_arena::current()
+{
+	return *current_ptr();
+}
+
+node_value::node_value(uint32_t value)
+{
+	for (unsigned i = 0; i < 4; i++)
+		bytes_.push_back((uint8_t)(value >> (8 * i)));
+}
+
+node_value::node_value(const std::string& str)
+{
+	bool decimal = (!str.empty() && str[0] == 'd');
+	bool binary = (!str.empty() && str[0] == 'b');
+
+	auto convert_ch = [](char c) -> unsigned
+	{
+		if (c >= '0' && c <= '9')
+			return (c - '0');
+		if (c >= 'a' && c <= 'f')
+			return (c - 'a' + 10);
+		if (c >= 'A' && c <= 'F')
+			return (c - 'A' + 10);
+		return 0;
+	};
+
+	if (decimal || binary)
+	{
+		//bytes_ = bytes_ * base + digit, carried out on the little-endian byte string
+		unsigned base = (decimal ? 10 : 2);
+		for (size_t i = 1; i < str.length(); i++)
+		{
+			unsigned carry = convert_ch(str[i]);
+			for (auto& byte : bytes_)
+			{
+				unsigned val = byte * base + carry;
+				byte = (uint8_t)val;
+				carry = val >> 8;
+			}
+			if (carry)
+				bytes_.push_back((uint8_t)carry);
+		}
+	}
+	else
+	{
+		//every two hex digits form a byte, starting from the least significant end
+		for (size_t i = str.length(); i > 0; i -= std::min<size_t>(i, 2))
+		{
+			unsigned byte = convert_ch(str[i - 1]);
+			if (i >= 2)
+				byte |= convert_ch(str[i - 2]) << 4;
+			bytes_.push_back((uint8_t)byte);
+		}
+	}
+}
+
 gadget gadgetlib::operator+(const gadget& lhs, const gadget& rhs)
 {
 	gadget result(OP_KIND::PLUS, lhs, rhs);
@@ -75,6 +386,15 @@ gadget gadgetlib::ALL(const std::vector<gadget>& gadget_vec)
 	return temp;
 }
 
+gadget gadgetlib::SUM(const std::vector<gadget>& gadget_vec)
+{
+	assert(!gadget_vec.empty());
+	gadget temp = gadget_vec[0];
+	for (size_t i = 1; i < gadget_vec.size(); i++)
+		temp = temp + gadget_vec[i];
+	return temp;
+}
+
 gadget gadgetlib::TO_FIELD(const gadget& a)
 {
 	return gadget(OP_KIND::TO_FIELD, a);
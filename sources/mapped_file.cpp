@@ -0,0 +1,224 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace utils;
+
+namespace
+{
+	void check(bool success, const std::string& what)
+	{
+		if (!success)
+			throw std::runtime_error("mapped_file: " + what + " failed");
+	}
+}
+
+mapped_file::mapped_file(mapped_file&& other)
+{
+	*this = std::move(other);
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other)
+{
+	if (this != &other)
+	{
+		close();
+		std::swap(handle_, other.handle_);
+		std::swap(size_, other.size_);
+		std::swap(writable_, other.writable_);
+	}
+	return *this;
+}
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+#if defined(_WIN32)
+
+mapped_file mapped_file::create_temporary(const std::string& directory)
+{
+	char path[MAX_PATH];
+	check(GetTempFileNameA(directory.c_str(), "wgl", 0, path) != 0, "GetTempFileName");
+	HANDLE handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	check(handle != INVALID_HANDLE_VALUE, "CreateFile");
+	mapped_file result;
+	result.handle_ = handle;
+	result.writable_ = true;
+	return result;
+}
+
+mapped_file mapped_file::create(const std::string& path)
+{
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	check(handle != INVALID_HANDLE_VALUE, "CreateFile");
+	mapped_file result;
+	result.handle_ = handle;
+	result.writable_ = true;
+	return result;
+}
+
+mapped_file mapped_file::open_read_only(const std::string& path)
+{
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	check(handle != INVALID_HANDLE_VALUE, "CreateFile");
+	mapped_file result;
+	result.handle_ = handle;
+	LARGE_INTEGER size;
+	check(GetFileSizeEx(result.handle_, &size) != 0, "GetFileSizeEx");
+	result.size_ = (uint64_t)size.QuadPart;
+	return result;
+}
+
+bool mapped_file::is_open() const
+{
+	return handle_ != nullptr;
+}
+
+void mapped_file::resize(uint64_t size)
+{
+	LARGE_INTEGER pos;
+	pos.QuadPart = (LONGLONG)size;
+	check(SetFilePointerEx(handle_, pos, nullptr, FILE_BEGIN) != 0, "SetFilePointerEx");
+	check(SetEndOfFile(handle_) != 0, "SetEndOfFile");
+	size_ = size;
+}
+
+void mapped_file::close()
+{
+	if (handle_ != nullptr)
+		CloseHandle(handle_);
+	handle_ = nullptr;
+	size_ = 0;
+	writable_ = false;
+}
+
+void* mapped_file::map(uint64_t offset, size_t length)
+{
+	//the mapping object only has to cover this view; the view keeps it alive
+	uint64_t end = offset + length;
+	HANDLE mapping = CreateFileMappingA(handle_, nullptr,
+		writable_ ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(end >> 32), (DWORD)end, nullptr);
+	check(mapping != nullptr, "CreateFileMapping");
+	void* addr = MapViewOfFile(mapping, writable_ ? FILE_MAP_WRITE : FILE_MAP_READ,
+		(DWORD)(offset >> 32), (DWORD)offset, length);
+	CloseHandle(mapping);
+	check(addr != nullptr, "MapViewOfFile");
+	return addr;
+}
+
+void mapped_file::unmap(void* addr, size_t length)
+{
+	UnmapViewOfFile(addr);
+}
+
+void mapped_file::evict(void* addr, size_t length)
+{
+	FlushViewOfFile(addr, length);
+	//unlocking pages which are not locked removes them from the working set
+	VirtualUnlock(addr, length);
+}
+
+size_t mapped_file::granularity()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+}
+
+#else
+
+mapped_file mapped_file::create_temporary(const std::string& directory)
+{
+	std::string pattern = directory + "/wgl_spill_XXXXXX";
+	std::vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+	mapped_file result;
+	result.handle_ = mkstemp(path.data());
+	check(result.handle_ >= 0, "mkstemp");
+	unlink(path.data());
+	result.writable_ = true;
+	return result;
+}
+
+mapped_file mapped_file::create(const std::string& path)
+{
+	mapped_file result;
+	result.handle_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	check(result.handle_ >= 0, "open");
+	result.writable_ = true;
+	return result;
+}
+
+mapped_file mapped_file::open_read_only(const std::string& path)
+{
+	mapped_file result;
+	result.handle_ = ::open(path.c_str(), O_RDONLY);
+	check(result.handle_ >= 0, "open");
+	struct stat info;
+	check(fstat(result.handle_, &info) == 0, "fstat");
+	result.size_ = (uint64_t)info.st_size;
+	return result;
+}
+
+bool mapped_file::is_open() const
+{
+	return handle_ >= 0;
+}
+
+void mapped_file::resize(uint64_t size)
+{
+	check(ftruncate(handle_, (off_t)size) == 0, "ftruncate");
+	size_ = size;
+}
+
+void mapped_file::close()
+{
+	if (handle_ >= 0)
+		::close(handle_);
+	handle_ = -1;
+	size_ = 0;
+	writable_ = false;
+}
+
+void* mapped_file::map(uint64_t offset, size_t length)
+{
+	void* addr = mmap(nullptr, length, writable_ ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, handle_, (off_t)offset);
+	check(addr != MAP_FAILED, "mmap");
+	return addr;
+}
+
+void mapped_file::unmap(void* addr, size_t length)
+{
+	munmap(addr, length);
+}
+
+void mapped_file::evict(void* addr, size_t length)
+{
+	msync(addr, length, MS_SYNC);
+	madvise(addr, length, MADV_DONTNEED);
+}
+
+size_t mapped_file::granularity()
+{
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+#endif
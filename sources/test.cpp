@@ -2,11 +2,21 @@
 #include "basic_gadgets.hpp"
 #include "utils.hpp"
 #include "Field.hpp"
+#include "montgomery_field.hpp"
+#include "field_kernels.hpp"
 #include "hasher.hpp"
 #include "merkle_tree.hpp"
+#include "constraint_sinks.hpp"
+#include "r1cs_export.hpp"
+#include "protoboard_passes.hpp"
 
 #include <algorithm>
 #include <random>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 
 using namespace gadgetlib;
 
@@ -40,7 +50,11 @@ struct alt_bn128
 };
 
 using inner_field_impl = alt_bn128;
+#ifdef USE_MONTGOMERY_FIELD
+using field = MontgomeryField<inner_field_impl>;
+#else
 using field = Field<inner_field_impl>;
+#endif
 
 
 void check(const gadget& gadget)
@@ -48,7 +62,7 @@ void check(const gadget& gadget)
 	auto pboard = protoboard<field>();
 	auto annealing = engraver();
 	annealing.incorporate_gadget(pboard, gadget);
-	r1cs_example<field> example(pboard);
+	r1cs_example<field> example(std::move(pboard));
 	std::cout << "Number of constraints: " << example.constraint_system.size() << std::endl;
 	std::cout << "Satisfied: " << example.check_assignment() << std::endl;
 	//example.dump();
@@ -196,7 +210,7 @@ void check_MimC()
 	gadget input(0xdeadbeef, 32, true);
 	using hasher = merkle_tree::MimcHash<inner_field_impl, uint32_t>;
 	auto result = hasher::hash_leaf(0xdeadbeef);
-	gadget result_gadget(std::string("d") + result.to_string(), false);
+	gadget result_gadget(result, false);
 	gadget comparison = (result_gadget == MimcLeafHash(input));
 
 	check(comparison);
@@ -208,7 +222,7 @@ std::vector<gadget> convert_proof_to_gadget(const std::vector<FieldT>& x)
 	std::vector<gadget> result;
 	for (auto& elem : x)
 	{
-		result.emplace_back(std::string("d") + elem.to_string(), false);
+		result.emplace_back(elem, false);
 	}
 	return result;
 }
@@ -222,7 +236,7 @@ void check_merkle_proof()
 	gadget address(raw_address, tree.height(), true);
 	gadget leaf(tree.get_leaf_at_address(raw_address), 32, false);
 	std::vector<gadget> proof = convert_proof_to_gadget(tree.get_proof(raw_address));
-	gadget merkle_root = gadget(std::string("d")+tree.get_root().to_string(), true);
+	gadget merkle_root = gadget(tree.get_root(), true);
 	gadget flag = (merkle_tree_proof(address, leaf, proof, merkle_root, tree.height()));
 	check(flag);
 }
@@ -236,7 +250,7 @@ void check_transaction()
 	uint32_t raw_to_address = 3;
 	uint32_t raw_amount = 9;
 
-	gadget merkle_root_before = gadget(std::string("d") + tree.get_root().to_string(), true);
+	gadget merkle_root_before = gadget(tree.get_root(), true);
 
 	gadget from_address(raw_from_address, tree.height(), true);
 	gadget from_balance(tree.get_leaf_at_address(raw_from_address), 32, false);
@@ -251,7 +265,7 @@ void check_transaction()
 	gadget amount(raw_amount, 32, true);
 	std::vector<gadget> from_proof_after = convert_proof_to_gadget(tree.get_proof(raw_from_address));
 	std::vector<gadget> to_proof_after = convert_proof_to_gadget(tree.get_proof(raw_to_address));
-	gadget merkle_root_after = gadget(std::string("d") + tree.get_root().to_string(), true);
+	gadget merkle_root_after = gadget(tree.get_root(), true);
 
 	gadget flag = check_transaction(from_address, to_address, from_balance, to_balance, amount,
 		merkle_root_before, merkle_root_after, from_proof_before, to_proof_before,
@@ -450,54 +464,541 @@ void check_blackjack()
 }
 
 
+void check_field_kernels()
+{
+	using scalar_field = Field<alt_bn128>;
+	using mont_field = MontgomeryField<alt_bn128>;
+	const size_t BATCH_SIZE = 1021;
+
+	std::random_device rd;
+	std::mt19937_64 g(rd());
+	std::vector<std::string> a_str, b_str;
+	auto random_element = [&g]()
+	{
+		//leading zero: a bare 'b' or 'd' would be taken for a binary/decimal prefix
+		std::stringstream ss;
+		ss << "0" << std::hex;
+		for (unsigned i = 0; i < 4; i++)
+			ss << std::setw(16) << std::setfill('0') << g();
+		return ss.str();
+	};
+	for (size_t i = 0; i < BATCH_SIZE; i++)
+	{
+		a_str.push_back(random_element());
+		b_str.push_back(random_element());
+	}
+	//corner cases: zero and p - 1
+	a_str[0] = "0";
+	b_str[1] = std::string("d") + (-scalar_field::one()).to_string();
+	a_str[2] = b_str[1];
+	b_str[2] = b_str[1];
+
+	field_batch<alt_bn128> a(BATCH_SIZE), b(BATCH_SIZE);
+	for (size_t i = 0; i < BATCH_SIZE; i++)
+	{
+		a.set(i, mont_field(a_str[i]));
+		b.set(i, mont_field(b_str[i]));
+	}
+
+	bool consistent = true;
+	auto compare = [&](kernel_backend backend)
+	{
+		field_batch<alt_bn128> sum, product, square;
+		batch_add(sum, a, b, backend);
+		batch_mul(product, a, b, backend);
+		batch_square(square, a, backend);
+		for (size_t i = 0; i < BATCH_SIZE; i++)
+		{
+			scalar_field x(a_str[i]), y(b_str[i]);
+			consistent &= (sum.get(i).to_string() == (x + y).to_string());
+			consistent &= (product.get(i).to_string() == (x * y).to_string());
+			consistent &= (square.get(i).to_string() == (x * x).to_string());
+		}
+	};
+	compare(kernel_backend::SCALAR);
+	if (kernel_detail::cpu_has_avx2())
+		compare(kernel_backend::AVX2);
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+
+bool same_constraints(const r1cs_constraint_system<field>& lhs, const r1cs_constraint_system<field>& rhs)
+{
+	auto same_lc = [](const r1cs_linear_combination_view<field>& x, const r1cs_linear_combination_view<field>& y)
+	{
+		return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin(),
+			[](const r1cs_term<field>& u, const r1cs_term<field>& v) { return u.index == v.index && u.coeff == v.coeff; });
+	};
+	if (lhs.size() != rhs.size())
+		return false;
+	for (size_t i = 0; i < lhs.size(); i++)
+	{
+		if (!same_lc(lhs[i].a_, rhs[i].a_) || !same_lc(lhs[i].b_, rhs[i].b_) || !same_lc(lhs[i].c_, rhs[i].c_))
+			return false;
+	}
+	return true;
+}
+
+void check_constraint_sinks()
+{
+	gadget input(0x12345678, 32, false);
+	gadget result(0xc1840208, 32, true);
+	gadget comparison = (((input ^ gadget(0xf0e21561, 32)) + gadget(0xdeadbeef, 32)) == result);
+
+	auto reference = protoboard<field>();
+	engraver().incorporate_gadget(reference, comparison);
+	const auto& expected = reference.constraints_;
+	bool consistent = true;
+
+	auto stream = [&comparison](r1cs_constraint_sink<field>& sink)
+	{
+		auto pboard = protoboard<field>();
+		pboard.set_constraint_sink(&sink);
+		engraver().incorporate_gadget(pboard, comparison);
+		return pboard.num_constraints();
+	};
+
+	r1cs_memory_sink<field> memory_sink;
+	consistent &= (stream(memory_sink) == expected.size());
+	consistent &= same_constraints(memory_sink.system(), expected);
+
+	r1cs_counting_sink<field> counting_sink;
+	stream(counting_sink);
+	consistent &= (counting_sink.num_constraints() == expected.size());
+	consistent &= (counting_sink.num_terms() == expected.num_terms());
+
+	r1cs_constraint_system<field> collected;
+	r1cs_callback_sink<field> callback_sink([&collected](const pb_linear_combination<field>& a,
+		const pb_linear_combination<field>& b, const pb_linear_combination<field>& c)
+	{
+		collected.add_constraint(a, b, c);
+	});
+	stream(callback_sink);
+	consistent &= same_constraints(collected, expected);
+
+	const std::string path = "constraint_sink_test.bin";
+	{
+		r1cs_file_sink<field> file_sink(path);
+		stream(file_sink);
+		file_sink.close();
+		consistent &= (file_sink.num_constraints() == expected.size());
+	}
+	consistent &= same_constraints(read_r1cs_stream<field>(path), expected);
+	std::remove(path.c_str());
+
+	std::cout << "Number of constraints: " << expected.size() << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+
+//last word of the SHA-256 digest of a public 32-bit input compared with a public value;
+//the circuit the tests of the passes and of the export run on
+gadget sha256_tail_check()
+{
+	gadget input(0x33323138, 32, true);
+	gadget result(0x9D21310B, 32, true);
+	return ((sha256_gadget(input))[{224, 255}] == result);
+}
+
+//writes pboard as .r1cs/.wtns, reads both back and checks the header counts and that the
+//constraints read back are satisfied by the witness read back
+bool check_iden3_round_trip(const protoboard<field>& pboard)
+{
+	const std::string r1cs_path = "round_trip_test.r1cs";
+	const std::string wtns_path = "round_trip_test.wtns";
+	write_r1cs(pboard, r1cs_path);
+	write_wtns(pboard, wtns_path);
+
+	bool consistent = true;
+	{
+		r1cs_file_reader<field> r1cs(r1cs_path);
+		wtns_file_reader<field> wtns(wtns_path);
+		size_t num_wires = 1 + pboard.num_public_wires() + boost::icl::cardinality(pboard.auxiliary_wires());
+		consistent &= (r1cs.num_wires() == num_wires);
+		consistent &= (r1cs.num_public_inputs() == pboard.num_public_wires());
+		consistent &= (r1cs.num_constraints() == pboard.num_constraints());
+		consistent &= (r1cs.read_wire_labels().size() == num_wires);
+		consistent &= (wtns.size() == num_wires);
+
+		r1cs_example<field> example;
+		example.constraint_system = r1cs.read_constraints();
+		example.assignment.resize(wtns.size());
+		for (size_t i = 0; i < wtns.size(); i++)
+			example.assignment[i] = wtns[i];
+		consistent &= (example.constraint_system.size() == pboard.num_constraints());
+		consistent &= example.check_assignment();
+	}
+	std::remove(r1cs_path.c_str());
+	std::remove(wtns_path.c_str());
+	return consistent;
+}
+
+void check_iden3_export()
+{
+	gadget comparison = sha256_tail_check();
+
+	auto pboard = protoboard<field>();
+	engraver().incorporate_gadget(pboard, comparison);
+	bool consistent = check_iden3_round_trip(pboard);
+
+	//a file with a wrong magic is rejected
+	const std::string path = "malformed_test.r1cs";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "wtns" << std::string(64, '\0');
+	}
+	try
+	{
+		r1cs_file_reader<field> reader(path);
+		consistent = false;
+	}
+	catch (const std::runtime_error&)
+	{
+	}
+	std::remove(path.c_str());
+
+	std::cout << "Number of constraints: " << pboard.num_constraints() << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+
+void check_linear_elimination()
+{
+	gadget comparison = sha256_tail_check();
+
+	auto pboard = protoboard<field>();
+	engraver().incorporate_gadget(pboard, comparison);
+	size_t num_constraints = pboard.num_constraints();
+	//allocated by the shifts already, so this adds nothing
+	var_index_t zero = pboard.zero_var();
+	size_t num_removed = eliminate_linear_constraints(pboard);
+	bool consistent = (num_removed > 0 && !pboard.eliminated_wires.empty());
+	consistent &= (pboard.num_constraints() == num_constraints - num_removed);
+	//the exported files leave the eliminated wires out
+	consistent &= check_iden3_round_trip(pboard);
+
+	//the zero wire of the shifts is among the eliminated ones: constraints added afterwards
+	//must get a fresh zero wire, and cached packings must not be handed out again
+	consistent &= boost::icl::contains(pboard.eliminated_wires, zero);
+	gadget x(0x12345678, 32, false);
+	gadget y(0xdeadbeef, 32, false);
+	engraver().incorporate_gadget(pboard, ((x >> 4) ^ y) == gadget(0x01234567 ^ 0xdeadbeef, 32, true));
+	for (const auto& constraint : pboard.constraints_)
+		for (const auto* lc : { &constraint.a_, &constraint.b_, &constraint.c_ })
+			for (const auto& term : *lc)
+				consistent &= !boost::icl::contains(pboard.eliminated_wires, (var_index_t)term.index);
+	consistent &= check_iden3_round_trip(pboard);
+
+	std::cout << "Number of constraints: " << pboard.num_constraints() << " (" << num_removed <<
+		" removed)" << std::endl;
+	std::cout << "Satisfied: " << r1cs_example<field>(pboard).check_assignment() << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+void check_renumbering()
+{
+	gadget comparison = sha256_tail_check();
+
+	auto pboard = protoboard<field>();
+	engraver().incorporate_gadget(pboard, comparison);
+	size_t num_public = pboard.num_public_wires();
+	size_t num_constraints = pboard.num_constraints();
+	renumber_variables(pboard, true);
+
+	//public wires come first, right after the constant one
+	bool consistent = (num_public > 0 && pboard.num_public_wires() == num_public);
+	consistent &= (pboard.public_wires == variable_set(variable_interval::closed(1, (var_index_t)num_public)));
+	consistent &= (pboard.num_constraints() == num_constraints);
+	//rows are ordered by the highest wire they use
+	uint32_t previous = 0;
+	for (const auto& constraint : pboard.constraints_)
+	{
+		uint32_t last = 0;
+		for (const auto* lc : { &constraint.a_, &constraint.b_, &constraint.c_ })
+			if (!lc->empty())
+				last = std::max(last, (lc->end() - 1)->index);
+		consistent &= (previous <= last);
+		previous = last;
+	}
+
+	std::cout << "Number of constraints: " << pboard.num_constraints() << std::endl;
+	std::cout << "Satisfied: " << r1cs_example<field>(std::move(pboard)).check_assignment() << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+void check_deduplication()
+{
+	gadget comparison = sha256_tail_check();
+
+	auto plain = protoboard<field>();
+	engraver().incorporate_gadget(plain, comparison);
+	auto pboard = protoboard<field>();
+	pboard.enable_deduplication();
+	engraver().incorporate_gadget(pboard, comparison);
+	bool consistent = (pboard.num_packing_cache_hits() > 0);
+	consistent &= (pboard.num_constraints() < plain.num_constraints());
+	std::cout << "Number of constraints: " << pboard.num_constraints() << " (" << plain.num_constraints() <<
+		" without deduplication, " << pboard.num_packing_cache_hits() << " packing cache hits)" << std::endl;
+	std::cout << "Satisfied: " << r1cs_example<field>(std::move(pboard)).check_assignment() << std::endl;
+
+	//rows equal up to the order of a and b and to the representation of their coefficients
+	auto rows = protoboard<field>();
+	rows.enable_deduplication();
+	pb_variable<field> x(rows.get_free_var()), y(rows.get_free_var()), z(rows.get_free_var());
+	field minus_one = -field::one();
+	field minus_one_big = field(std::string("d") + minus_one.to_string());
+	rows.add_r1cs_constraint(pb_linear_term<field>(x), pb_linear_term<field>(y, minus_one), pb_linear_term<field>(z));
+	rows.add_r1cs_constraint(pb_linear_term<field>(y, minus_one_big), pb_linear_term<field>(x), pb_linear_term<field>(z));
+	rows.add_r1cs_constraint(pb_linear_term<field>(x), pb_linear_term<field>(y), pb_linear_term<field>(z));
+	consistent &= (rows.num_constraints() == 2 && rows.num_duplicate_constraints() == 1);
+	consistent &= (rows.num_packing_cache_hits() == 0);
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+
+void check_interning()
+{
+	const uint32_t a_val = 0x12345678, b_val = 0xdeadbeef;
+
+	//(a ^ b) + (a & b) twice, the second time with all operands swapped
+	auto engrave = [&](bool interning, size_t& num_interned, bool& shared)
+	{
+		node_arena::scope scope;
+		scope.arena().enable_interning(interning);
+		gadget a(a_val, 32, false);
+		gadget b(b_val, 32, false);
+		gadget result((a_val ^ b_val) + (a_val & b_val), 32, true);
+		gadget first = (a ^ b) + (a & b);
+		gadget second = (b & a) + (b ^ a);
+		num_interned = scope.arena().num_interned();
+		shared = (first.node_ == second.node_);
+
+		//inputs are never merged, so neither is anything built over them
+		gadget c(a_val, 32, false);
+		gadget third = (c ^ b) + (c & b);
+		shared &= (third.node_ != first.node_ && scope.arena().num_interned() == num_interned);
+
+		auto pboard = protoboard<field>();
+		engraver().incorporate_gadget(pboard, ALL(ALL(first == result, second == result), third == result));
+		r1cs_example<field> example(std::move(pboard));
+		return std::make_pair(example.constraint_system.size(), example.check_assignment());
+	};
+
+	size_t num_interned = 0;
+	bool shared = false;
+	auto plain = engrave(false, num_interned, shared);
+	bool consistent = (num_interned == 0 && !shared);
+	auto interned = engrave(true, num_interned, shared);
+	consistent &= (num_interned == 3 && shared);
+	consistent &= (interned.second == plain.second && interned.first < plain.first);
+
+	std::cout << "Number of constraints: " << interned.first << " (" << plain.first <<
+		" without interning)" << std::endl;
+	std::cout << "Satisfied: " << interned.second << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+//true if g was folded into a constant equal to value on bitsize bits
+bool folds_to(const gadget& g, uint32_t value, uint32_t bitsize)
+{
+	if (g.kind_ != NODE_KIND::CONSTANT_GADGET || g.get_bitsize() != bitsize)
+		return false;
+	auto* constant = static_cast<const const_node*>(g.node_);
+	for (uint32_t i = 0; i < bitsize; i++)
+	{
+		if (constant->value_.get_bit(i) != (i < 32 && ((value >> i) & 1)))
+			return false;
+	}
+	return true;
+}
+
+void check_constant_folding()
+{
+	gadget x(0x12345678, 32);
+	bool consistent = true;
+	consistent &= folds_to(gadget(0x30, 32) + gadget(0x20, 32), 0x50, 32);
+	consistent &= folds_to(gadget(0xfffffff0, 32) + gadget(0x20, 32), 0x10, 32);
+	consistent &= folds_to(gadget(0x30, 32) - gadget(0x20, 32), 0x10, 32);
+	//a borrow is left to the engraver, which does not wrap subtractions around
+	consistent &= ((gadget(0x10, 32) - gadget(0x20, 32)).kind_ == NODE_KIND::OPERATION_GADGET);
+	consistent &= folds_to(x >> 4, 0x01234567, 32);
+	consistent &= folds_to(x.rotate_right(8), 0x78123456, 32);
+	consistent &= folds_to(x.rotate_left(8), 0x34567812, 32);
+	//bits are indexed from the most significant one
+	consistent &= folds_to(x[{0, 7}], 0x12, 8);
+	consistent &= folds_to(x[{24, 31}], 0x78, 8);
+	consistent &= folds_to(gadget(0x12, 8) || gadget(0x34, 8), 0x1234, 16);
+	consistent &= folds_to(EXTEND(gadget(0xab, 8), 16), 0xab, 16);
+	consistent &= folds_to((x ^ gadget(0xffffffff, 32)) & gadget(0xff, 32), 0x87, 32);
+
+	gadget first_var(0xdeadbeef, 32, false);
+	gadget second_var(0x12345678, 32, false);
+	consistent &= (ITE(gadget(1, 1), first_var, second_var).node_ == first_var.node_);
+	consistent &= (ITE(gadget(0, 1), first_var, second_var).node_ == second_var.node_);
+	//a variable operand is left to the engraver
+	consistent &= ((first_var + x).kind_ == NODE_KIND::OPERATION_GADGET);
+
+	//folding keeps the verdict of the same expression over inputs
+	auto verdict = [](const gadget& g)
+	{
+		auto pboard = protoboard<field>();
+		engraver().incorporate_gadget(pboard, g);
+		return r1cs_example<field>(std::move(pboard)).find_unsatisfied().empty();
+	};
+	auto same_verdict = [&verdict](OP_KIND kind, uint32_t a, uint32_t b, uint32_t expected)
+	{
+		gadget folded(kind, gadget(a, 32), gadget(b, 32));
+		gadget engraved(kind, gadget(a, 32, false), gadget(b, 32, false));
+		return verdict(folded == gadget(expected, 32, true)) ==
+			verdict(engraved == gadget(expected, 32, true));
+	};
+	consistent &= same_verdict(OP_KIND::PLUS, 0xfffffff0, 0x20, 0x10);
+	consistent &= same_verdict(OP_KIND::MINUS, 0x30, 0x20, 0x10);
+	consistent &= same_verdict(OP_KIND::MINUS, 0x10, 0x20, 0xfffffff0);
+
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+void check_sum()
+{
+	bool consistent = true;
+	//n 32-bit inputs summed modulo 2^32; with compare the sum is checked against its
+	//expected value, otherwise the sum itself is the root
+	auto engrave = [&consistent](unsigned n, bool compare)
+	{
+		std::vector<gadget> summands;
+		uint32_t expected = 0;
+		for (unsigned i = 0; i < n; i++)
+		{
+			uint32_t val = 0xf0000000 + 0x01010101 * i;
+			summands.emplace_back(val, 32, false);
+			expected += val;
+		}
+		gadget sum = SUM(summands);
+		auto pboard = protoboard<field>();
+		engraver().incorporate_gadget(pboard, compare ? (sum == gadget(expected, 32, true)) : sum);
+		r1cs_example<field> example(std::move(pboard));
+		consistent &= example.check_assignment();
+		return example.constraint_system.size();
+	};
+
+	size_t pair_rows = engrave(2, true);
+	size_t many_rows = engrave(100, true);
+	//one row for the whole sum; only the overflow grows, by ceil(log2(100)) - 1 bits
+	consistent &= (many_rows == pair_rows + 6);
+	consistent &= (engrave(100, false) == 1);
+
+	std::cout << "Number of constraints: " << many_rows << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+void check_node_arenas()
+{
+	auto throws = [](const std::function<void()>& func)
+	{
+		try
+		{
+			func();
+		}
+		catch (const std::runtime_error&)
+		{
+			return true;
+		}
+		return false;
+	};
+	auto engrave = [](const gadget& g)
+	{
+		auto pboard = protoboard<field>();
+		engraver().incorporate_gadget(pboard, g);
+		r1cs_example<field> example(std::move(pboard));
+		return std::make_pair(example.constraint_system.size(), example.check_assignment());
+	};
+
+	bool consistent = true;
+	gadget outer(0x12345678, 32, false);
+	gadget dead;
+	{
+		node_arena::scope scope;
+		gadget inner(0xdeadbeef, 32, false);
+		//operands of another arena
+		consistent &= throws([&]() { outer + inner; });
+		consistent &= throws([&]() { ITE(gadget(0, 1, false), inner, outer); });
+		consistent &= throws([&]() { gadget() ^ inner; });
+		dead = inner + inner;
+	}
+	//the arena of dead is freed by now
+	consistent &= throws([&]() { outer + dead; });
+	consistent &= throws([&]() { engrave(dead); });
+	{
+		node_arena::scope scope;
+		gadget x(0x12345678, 32, false);
+		gadget y = x + x;
+		scope.arena().clear();
+		consistent &= throws([&]() { x + gadget(1, 32); });
+		consistent &= throws([&]() { engrave(y == gadget(0x2468acf0, 32, true)); });
+	}
+
+	//the same circuit after a thousand throwaway ones in the same arena
+	auto circuit = []()
+	{
+		gadget x(0x12345678, 32, false);
+		return ((x >> 4) ^ x) + x == gadget(((0x12345678 >> 4) ^ 0x12345678) + 0x12345678, 32, true);
+	};
+	auto fresh = engrave(circuit());
+	for (unsigned i = 0; i < 1000; i++)
+		circuit();
+	auto late = engrave(circuit());
+	consistent &= (fresh.second && late == fresh);
+
+	std::cout << "Satisfied: " << late.second << std::endl;
+	std::cout << "Consistent: " << consistent << std::endl;
+}
+
+//every check builds its circuit in an arena of its own, freed once the check is done
+void run_check(const char* title, void (*check_func)())
+{
+	std::cout << title << std::endl;
+	node_arena::scope scope;
+	check_func();
+}
+
 void test_all()
 {
-	std::cout << "check addition: " << std::endl;
-	check_addition();
-	std::cout << "check concat_extract: " << std::endl;
-	check_concat_extract();
-	std::cout << "check concat_extract2: " << std::endl;
-	check_concat_extract2();
-	std::cout << "check shr: " << std::endl;
-	check_shr();
-	std::cout << "check rotate: " << std::endl;
-	check_rotate();		
-	std::cout << "check ITE: " << std::endl;
-	check_ITE();
-	std::cout << "check leq: " << std::endl;
-	check_leq();
-	std::cout << "check addition_xor: " << std::endl;
-	check_addition_xor();
-	std::cout << "check and: " << std::endl;
-	check_and();
-	std::cout << "check not: " << std::endl;
-	check_not();
-	std::cout << "check sha256: " << std::endl;
-	check_sha256();
-	std::cout << "check sha256v2: " << std::endl;
-	check_sha256v2();
-	std::cout << "check common prefix mask: " << std::endl;
-	check_common_prefix_mask();
-	std::cout << "check battleship_game: (Note that second and third tests should fail!" << std::endl;
-	check_battleship_game();
-	std::cout << "check chooser_gadget: " << std::endl;
-	check_chooser_gadget();
-	std::cout << "check shuffle: " << std::endl;
-	check_shuffle();
-	std::cout << "check MimC hash: " << std::endl;
-	check_MimC();
-	std::cout << "check Merkle-proof: " << std::endl;
-	check_merkle_proof();
-	std::cout << "check plasma transaction: " << std::endl;
-	check_transaction();
-	std::cout << "check blackjack game (first permutation): " << std::endl;
-	check_blackjack();
-	std::cout << "check blackjack game (second permutation): " << std::endl;
-	check_blackjack();
+	run_check("check addition: ", check_addition);
+	run_check("check concat_extract: ", check_concat_extract);
+	run_check("check concat_extract2: ", check_concat_extract2);
+	run_check("check shr: ", check_shr);
+	run_check("check rotate: ", check_rotate);
+	run_check("check ITE: ", check_ITE);
+	run_check("check leq: ", check_leq);
+	run_check("check addition_xor: ", check_addition_xor);
+	run_check("check and: ", check_and);
+	run_check("check not: ", check_not);
+	run_check("check sha256: ", check_sha256);
+	run_check("check sha256v2: ", check_sha256v2);
+	run_check("check common prefix mask: ", check_common_prefix_mask);
+	run_check("check battleship_game: (Note that second and third tests should fail!", check_battleship_game);
+	run_check("check chooser_gadget: ", check_chooser_gadget);
+	run_check("check shuffle: ", check_shuffle);
+	run_check("check MimC hash: ", check_MimC);
+	run_check("check Merkle-proof: ", check_merkle_proof);
+	run_check("check plasma transaction: ", check_transaction);
+	run_check("check blackjack game (first permutation): ", check_blackjack);
+	run_check("check blackjack game (second permutation): ", check_blackjack);
+	run_check("check batch field kernels: ", check_field_kernels);
+	run_check("check constraint sinks: ", check_constraint_sinks);
+	run_check("check iden3 export: ", check_iden3_export);
+	run_check("check linear elimination: ", check_linear_elimination);
+	run_check("check renumbering: ", check_renumbering);
+	run_check("check deduplication: ", check_deduplication);
+	run_check("check interning: ", check_interning);
+	run_check("check constant folding: ", check_constant_folding);
+	run_check("check SUM: ", check_sum);
+	run_check("check node arenas: ", check_node_arenas);
 }
 
 int main(int argc, char* argv[])
 {
 	test_all();
 	getchar();
-}
\ No newline at end of file
+}
\ No newline at end of file